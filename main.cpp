@@ -9,14 +9,40 @@
  *    -> if not: fire
  */
 #include <cstdint>
+#include <cmath>
 #include <ctime>
 #include <cstring>
 #include <iostream>
 #include <iomanip>
 #include <chrono>
 #include <thread>
+#include <memory>
+#include <string>
+#include <atomic>
+#include <mutex>
+#include <fstream>
+#include <sstream>
+#include <functional>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <random>
+#include <condition_variable>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 
 #include <unistd.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <linux/uinput.h>
 #include <png.h>
 #include <errno.h>
 
@@ -27,11 +53,23 @@
 #include <X11/Xutil.h>
 #include <X11/keysym.h>
 #include <X11/extensions/XTest.h>
+#include <X11/extensions/Xdamage.h>
+#include <X11/extensions/Xcomposite.h>
+#include <X11/extensions/Xrandr.h>
+
+#ifdef LOOPGRAB_PIPEWIRE
+#include <pipewire/pipewire.h>
+#include <spa/param/video/format-utils.h>
+#include <linux/dma-buf.h>
+#endif
 
 
 using namespace std;
 
 
+// the 4th byte is padding in BGRx frames (X depth 24, most screencasts) and never compared
+static const uint32_t colorMask = 0x00ffffff;
+
 struct Pixel
 {
     uint32_t c;
@@ -78,12 +116,12 @@ struct Pixel
 
 bool operator== (const Pixel& p1, const Pixel& p2)
 {
-    return p1.c == p2.c;
+    return ((p1.c ^ p2.c) & colorMask) == 0;
 }
 
 bool operator!= (const Pixel& p1, const Pixel& p2)
 {
-    return p1.c != p2.c;
+    return ((p1.c ^ p2.c) & colorMask) != 0;
 }
 
 ostream & operator<<(ostream &os, const Pixel& p)
@@ -96,6 +134,19 @@ ostream & operator<<(ostream &os, const Pixel& p)
 }
 
 
+struct Point
+{
+    int x;
+    int y;
+
+    Point(int x, int y) :
+        x(x),
+        y(y)
+    {
+    }
+};
+
+
 struct Rect
 {
     int x0;
@@ -153,6 +204,14 @@ struct Rect
         y1 = max(other.y1, y1);
     }
 
+    void clip(const Rect& other)
+    {
+        x0 = min(other.x1, max(other.x0, x0));
+        y0 = min(other.y1, max(other.y0, y0));
+        x1 = max(x0, min(other.x1, x1));
+        y1 = max(y0, min(other.y1, y1));
+    }
+
     friend bool operator== (const Rect& r1, const Rect& r2);
     friend bool operator!= (const Rect& r1, const Rect& r2);
 };
@@ -172,674 +231,7022 @@ ostream & operator<<(ostream &os, const Rect& r)
     return os << "{{" << r.x0 << ", " << r.y0 << "}, {" << r.x1 << ", " << r.y1 << "}}";
 }
 
-
-class GameFrame
+// value with a fixed number of decimals, for logs: leaves the format of the log stream alone
+static string fixedPoint(double value, int decimals)
 {
-public:
-
-    virtual void next() = 0;
-
-    virtual Pixel getPixel(int x, int y) const = 0;
+    ostringstream os;
+    os << fixed << setprecision(decimals) << value;
+    return os.str();
+}
 
-    virtual void savePng(const string path) const = 0;
-};
 
-class GameControls
+// connected pixels of one color
+struct Blob
 {
-public:
-
-    virtual void fire() = 0;
+    Rect bounds;    // inclusive
+    int pixels;
+    double x;       // centroid
+    double y;
+
+    Blob() :
+        bounds(),
+        pixels(0),
+        x(0),
+        y(0)
+    {
+    }
 
-    virtual void move(int x, int y) = 0;
+    explicit Blob(const Rect& bounds) :
+        bounds(bounds),
+        pixels(0),
+        x((bounds.x0 + bounds.x1) / 2.0),
+        y((bounds.y0 + bounds.y1) / 2.0)
+    {
+    }
+};
 
-    virtual void click(int x, int y) = 0;
 
-    virtual void focus(int x, int y) = 0;
-};
+typedef chrono::steady_clock Clock;
 
 
-class Game
+// direct view onto 32 bpp little-endian BGRA rows, addressed in screen coordinates
+struct PixelView
 {
-    const Pixel fieldColor = {0xf6, 0xf9, 0xfb, 0x00};
-    const Pixel ballColor = {0x51, 0x3d, 0x2c, 0x00};
-
-    GameControls& controls;
-    const int width;
-    const int height;
-    Rect screen;
-    Rect ball;
-    Rect field;
-    int frameCount;
-    int lastFire;
-    time_t lastBall;
-    time_t lastBallMove;
-    int deadzoneFrames;
-    int ignoredCount;
-    bool hasFired;
+    const uint8_t *data;
+    int stride;     // bytes per row
+    Rect bounds;    // screen area covered by data
+
+    PixelView() :
+        data(nullptr),
+        stride(0),
+        bounds()
+    {
+    }
 
-    void limit(Rect& r)
+    PixelView(const uint8_t *data, int stride, const Rect& bounds) :
+        data(data),
+        stride(stride),
+        bounds(bounds)
     {
-        r.x0 = min(r.x1, min(width, max(0, r.x0)));
-        r.y0 = min(r.y1, min(height, max(0, r.y0)));
-        r.x1 = max(r.x0, min(width, max(0, r.x1)));
-        r.y1 = max(r.y0, min(height, max(0, r.y1)));
     }
 
-    bool shrink(Rect& r)
+    bool valid() const
     {
-        r.x0 = r.x0 + 1;
-        r.y0 = r.y0 + 1;
-        r.x1 = r.x1 - 1;
-        r.y1 = r.y1 - 1;
+        return data != nullptr;
+    }
 
-        limit(r);
+    // row distance in pixels
+    ptrdiff_t pitch() const
+    {
+        return stride / (ptrdiff_t)sizeof(uint32_t);
+    }
 
-        return r.x0 != r.x1 || r.y0 != r.y1;
+    // caller ensures bounds.contains(x, y)
+    const uint32_t* at(int x, int y) const
+    {
+        return reinterpret_cast<const uint32_t*>(data + (size_t)(y - bounds.y0) * stride) + (x - bounds.x0);
     }
+};
 
-    bool expand(Rect& r)
+// find first pixel p[i * step] == color (ignoring padding) for i in [0, n), returns n if there is none
+typedef int (*FindPixelKernel)(const uint32_t *p, int n, ptrdiff_t step, uint32_t color);
+
+static int findPixelScalar(const uint32_t *p, int n, ptrdiff_t step, uint32_t color)
+{
+    for (int i = 0; i < n; ++i, p += step)
     {
-        r.x0 = r.x0 - 1;
-        r.y0 = r.y0 - 1;
-        r.x1 = r.x1 + 1;
-        r.y1 = r.y1 + 1;
+        if (((*p ^ color) & colorMask) == 0)
+        {
+            return i;
+        }
+    }
+    return n;
+}
 
-        limit(r);
+#if defined(__x86_64__) || defined(__i386__)
 
-        return r.x0 != 0 || r.y0 != 0 || r.x1 != width || r.y1 != height;
+[[gnu::target("sse2")]]
+static int findPixelSse2(const uint32_t *p, int n, ptrdiff_t step, uint32_t color)
+{
+    if (step != 1)
+    {
+        // no gather before AVX2
+        return findPixelScalar(p, n, step, color);
     }
 
-    bool topContainsColor(const GameFrame& frame, const Rect& r, const Pixel& color)
+    const __m128i m = _mm_set1_epi32((int)colorMask);
+    const __m128i c = _mm_set1_epi32((int)(color & colorMask));
+    int i = 0;
+    for (; i + 4 <= n; i += 4)
     {
-        // top
-        for (int x = r.x0; x < r.x1; ++x)
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+        const int mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(v, m), c)));
+        if (mask)
         {
-            if (frame.getPixel(x, r.y0) == color)
-            {
-                return true;
-            }
+            return i + __builtin_ctz(mask);
         }
-        return false;
     }
+    return i + findPixelScalar(p + i, n - i, 1, color);
+}
 
-    bool bottomContainsColor(const GameFrame& frame, const Rect& r, const Pixel& color)
+[[gnu::target("avx2")]]
+static int findPixelAvx2(const uint32_t *p, int n, ptrdiff_t step, uint32_t color)
+{
+    const __m256i m = _mm256_set1_epi32((int)colorMask);
+    const __m256i c = _mm256_set1_epi32((int)(color & colorMask));
+    int i = 0;
+    if (step == 1)
     {
-        // bottom
-        for (int x = r.x0; x < r.x1; ++x)
+        for (; i + 8 <= n; i += 8)
         {
-            if (frame.getPixel(x, r.y1) == color)
+            const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+            const int mask = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(v, m), c)));
+            if (mask)
             {
-                return true;
+                return i + __builtin_ctz(mask);
             }
         }
-        return false;
     }
-
-    bool leftContainsColor(const GameFrame& frame, const Rect& r, const Pixel& color)
+    else if (step * 8 <= INT32_MAX && step * 8 >= INT32_MIN)
     {
-        // left
-        for (int y = r.y0; y < r.y1; ++y)
+        // column or grid scan: gather 8 pixels step apart
+        const int s = (int)step;
+        const __m256i index = _mm256_setr_epi32(0, s, 2 * s, 3 * s, 4 * s, 5 * s, 6 * s, 7 * s);
+        for (; i + 8 <= n; i += 8)
         {
-            if (frame.getPixel(r.x0, y) == color)
+            const __m256i v = _mm256_i32gather_epi32(reinterpret_cast<const int*>(p + i * step), index, 4);
+            const int mask = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(v, m), c)));
+            if (mask)
             {
-                return true;
+                return i + __builtin_ctz(mask);
             }
         }
+    }
+    return i + findPixelScalar(p + i * step, n - i, step, color);
+}
 
-        return false;
+#endif
+
+static FindPixelKernel selectFindPixelKernel(const char **name)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        *name = "avx2";
+        return findPixelAvx2;
+    }
+    if (__builtin_cpu_supports("sse2"))
+    {
+        *name = "sse2";
+        return findPixelSse2;
     }
+#endif
+    *name = "scalar";
+    return findPixelScalar;
+}
+
+static const char *findPixelName = "";
+static const FindPixelKernel findPixel = selectFindPixelKernel(&findPixelName);
 
-    bool rightContainsColor(const GameFrame& frame, const Rect& r, const Pixel& color)
+// find first pixel base[offsets[i]] == color (ignoring padding) for i in [0, n), returns n if there is none
+typedef int (*FindPixelIndexedKernel)(const uint32_t *base, const int32_t *offsets, int n, uint32_t color);
+
+static int findPixelIndexedScalar(const uint32_t *base, const int32_t *offsets, int n, uint32_t color)
+{
+    for (int i = 0; i < n; ++i)
     {
-        // right
-        for (int y = r.y0; y < r.y1; ++y)
+        if (((base[offsets[i]] ^ color) & colorMask) == 0)
         {
-            if (frame.getPixel(r.x1, y) == color)
-            {
-                return true;
-            }
+            return i;
         }
-        return false;
     }
+    return n;
+}
 
-    bool findColorBounds(const GameFrame& frame, Rect& rect, const Pixel& color)
+#if defined(__x86_64__) || defined(__i386__)
+
+[[gnu::target("avx2")]]
+static int findPixelIndexedAvx2(const uint32_t *base, const int32_t *offsets, int n, uint32_t color)
+{
+    const __m256i m = _mm256_set1_epi32((int)colorMask);
+    const __m256i c = _mm256_set1_epi32((int)(color & colorMask));
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
     {
-        Rect r1 = rect;
-        Rect r0;
-        do
+        const __m256i index = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(offsets + i));
+        const __m256i v = _mm256_i32gather_epi32(reinterpret_cast<const int*>(base), index, 4);
+        const int mask = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(v, m), c)));
+        if (mask)
         {
-            r0 = r1;
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return i + findPixelIndexedScalar(base, offsets + i, n - i, color);
+}
 
-            // -x0
-            r1.x0 = max(0, r1.x0 - 1);
-            if (!leftContainsColor(frame, r1, color))
-            {
-                r1.x0 = r0.x0;
-            }
+#endif
 
-            // -y0
-            r1.y0 = max(0, r1.y0 - 1);
-            if (!topContainsColor(frame, r1, color))
-            {
-                r1.y0 = r0.y0;
-            }
+static FindPixelIndexedKernel selectFindPixelIndexedKernel()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        return findPixelIndexedAvx2;
+    }
+#endif
+    return findPixelIndexedScalar;
+}
 
-            // +x1
-            r1.x1 = min(width - 1, r1.x1 + 1);
-            if (!rightContainsColor(frame, r1, color))
-            {
-                r1.x1 = r0.x1;
-            }
+static const FindPixelIndexedKernel findPixelIndexed = selectFindPixelIndexedKernel();
 
-            // +y1
-            r1.y1 = min(height - 1, r1.y1 + 1);
-            if (!bottomContainsColor(frame, r1, color))
-            {
-                r1.y1 = r0.y1;
-            }
+// hash of the pixels base[offsets[i]] (ignoring padding) for i in [0, n): FNV-1a over 8 lanes
+// (pixel i goes to lane i % 8, so the gather kernel computes the same), folded to 64 bits
+typedef uint64_t (*HashPixelsKernel)(const uint32_t *base, const int32_t *offsets, int n);
 
-            //cerr << "findColorBounds(): r0=" << r0 << ", r1=" << r1 << endl;
-        }
-        while (r0 != r1);
+static uint64_t foldLanes(const uint32_t *lanes)
+{
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (int l = 0; l < 8; ++l)
+    {
+        h = (h ^ lanes[l]) * 0x100000001b3ull;
+    }
+    return h;
+}
 
-        if (rect != r0)
-        {
-            rect = r0;
-            return true;
-        }
+static void hashPixelsLanes(const uint32_t *base, const int32_t *offsets, int i, int n, uint32_t *lanes)
+{
+    for (; i < n; ++i)
+    {
+        uint32_t& h = lanes[i % 8];
+        h = (h ^ (base[offsets[i]] & colorMask)) * 0x01000193u;
+    }
+}
 
-        return false;
+static uint64_t hashPixelsScalar(const uint32_t *base, const int32_t *offsets, int n)
+{
+    uint32_t lanes[8];
+    for (int l = 0; l < 8; ++l)
+    {
+        lanes[l] = 0x811c9dc5u + l;
     }
+    hashPixelsLanes(base, offsets, 0, n, lanes);
+    return foldLanes(lanes);
+}
 
-    bool isBallSurrounded(const GameFrame& frame, const Rect& ball)
+#if defined(__x86_64__) || defined(__i386__)
+
+[[gnu::target("avx2")]]
+static uint64_t hashPixelsAvx2(const uint32_t *base, const int32_t *offsets, int n)
+{
+    const __m256i m = _mm256_set1_epi32((int)colorMask);
+    const __m256i prime = _mm256_set1_epi32(0x01000193);
+    __m256i h = _mm256_add_epi32(_mm256_set1_epi32((int)0x811c9dc5u), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
     {
-        Rect f = ball;
+        const __m256i index = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(offsets + i));
+        const __m256i v = _mm256_i32gather_epi32(reinterpret_cast<const int*>(base), index, 4);
+        h = _mm256_mullo_epi32(_mm256_xor_si256(h, _mm256_and_si256(v, m)), prime);
+    }
 
-        // need ball frame (2 pixels outside for safety)
-        expand(f); 
-        expand(f);
-        expand(f);
+    uint32_t lanes[8];
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), h);
+    hashPixelsLanes(base, offsets, i, n, lanes);
+    return foldLanes(lanes);
+}
+
+#endif
 
-        return frame.getPixel(f.centerX(), f.y0) != fieldColor
-            && frame.getPixel(f.centerX(), f.y1) != fieldColor
-            && frame.getPixel(f.x0, f.centerY()) != fieldColor
-            && frame.getPixel(f.x1, f.centerY()) != fieldColor;
+static HashPixelsKernel selectHashPixelsKernel()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        return hashPixelsAvx2;
     }
+#endif
+    return hashPixelsScalar;
+}
+
+static const HashPixelsKernel hashPixels = selectHashPixelsKernel();
 
-    bool checkForBall(const GameFrame& frame, int x, int y, Rect& ball)
+// find first pixel p[i] != color (ignoring padding) for i in [0, n), returns n if there is none:
+// the end of a run of color
+typedef int (*SkipPixelKernel)(const uint32_t *p, int n, uint32_t color);
+
+static int skipPixelScalar(const uint32_t *p, int n, uint32_t color)
+{
+    for (int i = 0; i < n; ++i)
     {
-        if (frame.getPixel(x, y) != ballColor)
+        if (((p[i] ^ color) & colorMask) != 0)
         {
-            return false;
-        }
-
-        ball.x0 = x;
-        ball.y0 = y;
-        ball.x1 = x + 1;
-        ball.y1 = y + 1;;
-        if (findColorBounds(frame, ball, ballColor))
-        {
-            // a square and at least 3x3?
-            int width = ball.width();
-            int height = ball.height();
-            if (width > 4 && height > 4 && width == height)
-            {
-                // corners must not be ball color (it is round)
-                // while middle of edges must be
-                if (frame.getPixel(ball.x0, ball.y0) != ballColor
-                    && frame.getPixel(ball.x1, ball.y0) != ballColor
-                    && frame.getPixel(ball.x0, ball.y1) != ballColor
-                    && frame.getPixel(ball.x1, ball.y1) != ballColor
-                    && frame.getPixel(ball.x0 + (width / 2), ball.y0 + 1) == ballColor
-                    && frame.getPixel(ball.x0 + (width / 2), ball.y1 - 1) == ballColor
-                    && frame.getPixel(ball.x0 + 1, ball.y0 + (height / 2)) == ballColor
-                    && frame.getPixel(ball.x1 - 1, ball.y0 + (height / 2)) == ballColor)
-                {
-                    // is ball
-                    return true;
-                }
-            }
+            return i;
         }
-
-        return false;
     }
+    return n;
+}
 
-    bool findBall(const GameFrame& frame, const Rect& zone)
+#if defined(__x86_64__) || defined(__i386__)
+
+[[gnu::target("sse2")]]
+static int skipPixelSse2(const uint32_t *p, int n, uint32_t color)
+{
+    const __m128i m = _mm_set1_epi32((int)colorMask);
+    const __m128i c = _mm_set1_epi32((int)(color & colorMask));
+    int i = 0;
+    for (; i + 4 <= n; i += 4)
     {
-        Rect b = ball;
-        if (checkForBall(frame, b.centerX(), b.y0, b)
-            || checkForBall(frame, b.x0, b.centerY(), b)
-            || checkForBall(frame, b.centerX(), b.y1, b)
-            || checkForBall(frame, b.x1, b.centerY(), b))
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+        const int mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(v, m), c))) ^ 0xf;
+        if (mask)
         {
-            const time_t t = time(NULL);
-            if (ball != b)
-            {
-                //cerr << "ball follow: " << b << endl;
-                lastBallMove = t;
-            }
-            else
-            {
-                //cerr << "ball stuck: " << b << endl;
-            }
-            ball = b;
-            lastBall = t;
-            return true;
+            return i + __builtin_ctz(mask);
         }
+    }
+    return i + skipPixelScalar(p + i, n - i, color);
+}
 
-        // try to find ball in zone
-        b = ball;
-        for (int y = zone.y0; y < zone.y1; y += max(1, ball.height() / 2))
+[[gnu::target("avx2")]]
+static int skipPixelAvx2(const uint32_t *p, int n, uint32_t color)
+{
+    const __m256i m = _mm256_set1_epi32((int)colorMask);
+    const __m256i c = _mm256_set1_epi32((int)(color & colorMask));
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+        const int mask = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(v, m), c))) ^ 0xff;
+        if (mask)
         {
-            for (int x = zone.x0; x < zone.x1; x += max(1, ball.width() / 2))
-            {
-                if (!b.contains(x, y) && checkForBall(frame, x, y, b))
-                {
-                    // cerr << "ball new: " << ball << endl;
-                    ball = b;
-                    const time_t t = time(NULL);
-                    lastBall = t;
-                    lastBallMove = t;
-                    return true;
-                }
-            }
+            return i + __builtin_ctz(mask);
         }
-
-        return false;
     }
+    return i + skipPixelSse2(p + i, n - i, color);
+}
 
-    // did we already identify the playing field boundaries for this game?
-    bool haveField() const
+#endif
+
+static SkipPixelKernel selectSkipPixelKernel()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
     {
-        int unit = max(4, ball.width());
-        return field.width() > unit * 10
-            && field.height() > unit * 10
-            && field.width() < field.height() + (unit / 4)
-            && field.width() > field.height() - (unit / 4);
+        return skipPixelAvx2;
     }
+    if (__builtin_cpu_supports("sse2"))
+    {
+        return skipPixelSse2;
+    }
+#endif
+    return skipPixelScalar;
+}
 
-    bool expandField(const GameFrame& frame)
+static const SkipPixelKernel skipPixel = selectSkipPixelKernel();
+
+// same searches on color classes: table maps the 15-bit index of a pixel (5 bits per channel)
+// to its class id, so classifying stays one load per pixel
+static inline uint32_t paletteIndex(uint32_t c)
+{
+    return ((c >> 3) & 0x1f) | ((c >> 6) & 0x3e0) | ((c >> 9) & 0x7c00);
+}
+
+typedef int (*FindClassKernel)(const uint32_t *p, int n, ptrdiff_t step, const uint8_t *table, uint8_t cls);
+typedef int (*FindClassIndexedKernel)(const uint32_t *base, const int32_t *offsets, int n, const uint8_t *table, uint8_t cls);
+typedef int (*SkipClassKernel)(const uint32_t *p, int n, const uint8_t *table, uint8_t cls);
+
+static int findClassScalar(const uint32_t *p, int n, ptrdiff_t step, const uint8_t *table, uint8_t cls)
+{
+    for (int i = 0; i < n; ++i, p += step)
     {
-        // while determining field, always search whole screen
-        if (!findBall(frame, Rect(0, 0, width, height)))
+        if (table[paletteIndex(*p)] == cls)
         {
-            if (field.x1 == 0)
-            {
-                cerr << "error: no ball found: proof saved to no-ball-proof.png" << endl;
-                frame.savePng("no-ball-proof.png");
-                return false;
-            }
-            return true;
+            return i;
         }
+    }
+    return n;
+}
 
-        if (field.x1 == 0)
-        {
-            // initialize
-            field = ball;
-        }
-        else
+static int findClassIndexedScalar(const uint32_t *base, const int32_t *offsets, int n, const uint8_t *table, uint8_t cls)
+{
+    for (int i = 0; i < n; ++i)
+    {
+        if (table[paletteIndex(base[offsets[i]])] == cls)
         {
-            // add current ball to field (search area)
-            field.add(ball);
+            return i;
         }
-
-        return true;
     }
+    return n;
+}
 
-    void addFieldSafetyMargin()
+static int skipClassScalar(const uint32_t *p, int n, const uint8_t *table, uint8_t cls)
+{
+    for (int i = 0; i < n; ++i)
     {
-        for (int i = 0; i < ball.width(); ++i)
+        if (table[paletteIndex(p[i])] != cls)
         {
-            expand(field);
+            return i;
         }
     }
+    return n;
+}
 
-    // simulate keypress
-    bool fire()
+#if defined(__x86_64__) || defined(__i386__)
+
+// mask of the 8 pixels in v whose class is cls, table needs 3 bytes of padding for the 32-bit gather
+[[gnu::target("avx2")]]
+static inline int classMaskAvx2(__m256i v, const uint8_t *table, __m256i cls)
+{
+    const __m256i index = _mm256_or_si256(
+        _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi32(v, 3), _mm256_set1_epi32(0x1f)),
+                        _mm256_and_si256(_mm256_srli_epi32(v, 6), _mm256_set1_epi32(0x3e0))),
+        _mm256_and_si256(_mm256_srli_epi32(v, 9), _mm256_set1_epi32(0x7c00)));
+    const __m256i c = _mm256_and_si256(_mm256_i32gather_epi32(reinterpret_cast<const int*>(table), index, 1), _mm256_set1_epi32(0xff));
+    return _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(c, cls)));
+}
+
+[[gnu::target("avx2")]]
+static int findClassAvx2(const uint32_t *p, int n, ptrdiff_t step, const uint8_t *table, uint8_t cls)
+{
+    const __m256i c = _mm256_set1_epi32(cls);
+    int i = 0;
+    if (step == 1)
     {
-        if (frameCount - lastFire >= deadzoneFrames)
+        for (; i + 8 <= n; i += 8)
         {
-            controls.fire();
-            cerr << "[" << frameCount << "] (ign. " << ignoredCount << ") FIRE!" << endl;
-            ignoredCount = 0;
-            lastFire = frameCount;
-            return true;
+            const int mask = classMaskAvx2(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i)), table, c);
+            if (mask)
+            {
+                return i + __builtin_ctz(mask);
+            }
         }
-        else
+    }
+    else if (step * 8 <= INT32_MAX && step * 8 >= INT32_MIN)
+    {
+        const int s = (int)step;
+        const __m256i index = _mm256_setr_epi32(0, s, 2 * s, 3 * s, 4 * s, 5 * s, 6 * s, 7 * s);
+        for (; i + 8 <= n; i += 8)
         {
-            ++ignoredCount;
-            return false;
+            const int mask = classMaskAvx2(_mm256_i32gather_epi32(reinterpret_cast<const int*>(p + i * step), index, 4), table, c);
+            if (mask)
+            {
+                return i + __builtin_ctz(mask);
+            }
+        }
+    }
+    return i + findClassScalar(p + i * step, n - i, step, table, cls);
+}
+
+[[gnu::target("avx2")]]
+static int findClassIndexedAvx2(const uint32_t *base, const int32_t *offsets, int n, const uint8_t *table, uint8_t cls)
+{
+    const __m256i c = _mm256_set1_epi32(cls);
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        const __m256i index = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(offsets + i));
+        const int mask = classMaskAvx2(_mm256_i32gather_epi32(reinterpret_cast<const int*>(base), index, 4), table, c);
+        if (mask)
+        {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return i + findClassIndexedScalar(base, offsets + i, n - i, table, cls);
+}
+
+[[gnu::target("avx2")]]
+static int skipClassAvx2(const uint32_t *p, int n, const uint8_t *table, uint8_t cls)
+{
+    const __m256i c = _mm256_set1_epi32(cls);
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        const int mask = classMaskAvx2(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i)), table, c) ^ 0xff;
+        if (mask)
+        {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return i + skipClassScalar(p + i, n - i, table, cls);
+}
+
+#endif
+
+struct ClassKernels
+{
+    FindClassKernel find;
+    FindClassIndexedKernel findIndexed;
+    SkipClassKernel skip;
+};
+
+static ClassKernels selectClassKernels()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        return {findClassAvx2, findClassIndexedAvx2, skipClassAvx2};
+    }
+#endif
+    return {findClassScalar, findClassIndexedScalar, skipClassScalar};
+}
+
+static const ClassKernels classKernels = selectClassKernels();
+
+
+// classifies pixels into the colors given (class i + 1, 0 for other colors).
+// With tolerance 0 a pixel has to match a color exactly. Otherwise it matches if no channel
+// differs by more than tolerance, on a 5 bit per channel table: colors up to 7 levels beyond
+// the tolerance can match as well
+class Palette
+{
+    vector<Pixel> colors;
+    int tolerance;
+    vector<uint8_t> table;      // by paletteIndex(), empty with tolerance 0
+
+public:
+
+    Palette(const vector<Pixel>& colors, int tolerance) :
+        colors(colors),
+        tolerance(tolerance),
+        table()
+    {
+        if (tolerance <= 0)
+        {
+            return;
+        }
+
+        // class of the nearest color within tolerance of some pixel of the cell
+        table.assign((1 << 15) + 3, 0);
+        for (uint32_t i = 0; i < (1 << 15); ++i)
+        {
+            int best = tolerance + 1;
+            for (size_t k = 0; k < colors.size(); ++k)
+            {
+                const uint32_t c = colors[k].c;
+                int d = 0;
+                for (int channel = 0; channel < 3; ++channel)
+                {
+                    const int v = (int)((c >> (8 * channel)) & 0xff);
+                    const int lo = (int)((i >> (5 * channel)) & 0x1f) << 3;
+                    d = max(d, max(0, max(lo - v, v - (lo + 7))));
+                }
+                if (d < best)
+                {
+                    best = d;
+                    table[i] = (uint8_t)(k + 1);
+                }
+            }
+        }
+    }
+
+    int getTolerance() const
+    {
+        return tolerance;
+    }
+
+    uint8_t classOf(const Pixel& p) const
+    {
+        if (!table.empty())
+        {
+            return table[paletteIndex(p.c)];
+        }
+        for (size_t k = 0; k < colors.size(); ++k)
+        {
+            if (p == colors[k])
+            {
+                return (uint8_t)(k + 1);
+            }
+        }
+        return 0;
+    }
+
+    bool is(const Pixel& p, uint8_t cls) const
+    {
+        return table.empty() ? p == colors[cls - 1] : table[paletteIndex(p.c)] == cls;
+    }
+
+    // findPixel(), findPixelIndexed() and skipPixel() by class
+    int find(const uint32_t *p, int n, ptrdiff_t step, uint8_t cls) const
+    {
+        return table.empty() ? findPixel(p, n, step, colors[cls - 1].c) : classKernels.find(p, n, step, table.data(), cls);
+    }
+
+    int findIndexed(const uint32_t *base, const int32_t *offsets, int n, uint8_t cls) const
+    {
+        return table.empty() ? findPixelIndexed(base, offsets, n, colors[cls - 1].c) : classKernels.findIndexed(base, offsets, n, table.data(), cls);
+    }
+
+    int skip(const uint32_t *p, int n, uint8_t cls) const
+    {
+        return table.empty() ? skipPixel(p, n, colors[cls - 1].c) : classKernels.skip(p, n, table.data(), cls);
+    }
+};
+
+
+// getPixel(), view() and savePng() refer to the frame grabbed by the last next() and stay
+// unchanged until the following call, even if capture itself runs concurrently
+class GameFrame
+{
+public:
+
+    virtual ~GameFrame()
+    {
+    }
+
+    virtual void next() = 0;
+
+    // restrict capture to region (screen coordinates), an empty region captures the whole screen
+    virtual void setRegion(const Rect& region) = 0;
+
+    // pixels outside of the captured region read as Pixel()
+    virtual Pixel getPixel(int x, int y) const = 0;
+
+    // fast path for 32 bpp BGRA frames, invalid view if not available (use getPixel() then)
+    virtual PixelView view() const = 0;
+
+    // when the current frame was grabbed
+    virtual Clock::time_point timestamp() const = 0;
+
+    virtual void savePng(const string path) const = 0;
+
+    // known to show the same as the previous frame (no new image arrived)
+    virtual bool repeated() const
+    {
+        return false;
+    }
+};
+
+class GameControls
+{
+public:
+
+    virtual ~GameControls()
+    {
+    }
+
+    virtual void fire() = 0;
+
+    virtual void move(int x, int y) = 0;
+
+    virtual void click(int x, int y) = 0;
+
+    virtual void focus(int x, int y) = 0;
+};
+
+// ignores everything, for benchmarks and when there is nothing to control
+class NullControls : public GameControls
+{
+public:
+
+    void fire()
+    {
+    }
+
+    void move(int x, int y)
+    {
+        (void) x;
+        (void) y;
+    }
+
+    void click(int x, int y)
+    {
+        (void) x;
+        (void) y;
+    }
+
+    void focus(int x, int y)
+    {
+        (void) x;
+        (void) y;
+    }
+};
+
+
+static const double twoPi = 2 * M_PI;
+
+// angle of the ball around the track center at the last few moves
+struct Trajectory
+{
+    static const int size = 6;
+
+    double angles[size];    // unwrapped, radians
+    Clock::time_point times[size];
+    int count;
+    int newest;
+
+    Trajectory() :
+        count(0),
+        newest(0)
+    {
+    }
+
+    void reset()
+    {
+        count = 0;
+    }
+
+    void add(double angle, Clock::time_point t)
+    {
+        if (count > 0 && t - times[newest] > chrono::milliseconds(250))
+        {
+            // lost track for too long, velocity would be meaningless
+            reset();
+        }
+
+        if (count > 0)
+        {
+            const double last = angles[newest];
+            const double unwrapped = last + remainder(angle - last, twoPi);
+            if (unwrapped == last)
+            {
+                // not moved (same frame content), keep time of the actual move
+                return;
+            }
+            newest = (newest + 1) % size;
+            angles[newest] = unwrapped;
+        }
+        else
+        {
+            angles[newest] = angle;
+        }
+        times[newest] = t;
+        count = min(size, count + 1);
+    }
+
+    bool ready() const
+    {
+        return count >= 3;
+    }
+
+    double angle() const
+    {
+        return angles[newest];
+    }
+
+    // radians per second, sign is the direction
+    double velocity() const
+    {
+        if (count < 2)
+        {
+            return 0;
+        }
+
+        const int oldest = (newest + size - count + 1) % size;
+        const double dt = chrono::duration<double>(times[newest] - times[oldest]).count();
+        return dt > 0 ? (angles[newest] - angles[oldest]) / dt : 0;
+    }
+
+    double predict(Clock::time_point t) const
+    {
+        return angles[newest] + velocity() * chrono::duration<double>(t - times[newest]).count();
+    }
+};
+
+
+// ball center on screen at the last two moves, predicts where to search next
+struct BallMotion
+{
+    double x;
+    double y;
+    double vx;              // pixels per second
+    double vy;
+    Clock::time_point time; // of the last move
+    int count;              // moves seen since the last reset, up to 2
+
+    BallMotion() :
+        x(0),
+        y(0),
+        vx(0),
+        vy(0),
+        time(),
+        count(0)
+    {
+    }
+
+    void reset()
+    {
+        count = 0;
+    }
+
+    void add(double bx, double by, Clock::time_point t)
+    {
+        if (count > 0 && t - time > chrono::milliseconds(250))
+        {
+            reset();
+        }
+
+        if (count > 0)
+        {
+            const double dt = chrono::duration<double>(t - time).count();
+            if ((bx == x && by == y) || dt <= 0)
+            {
+                // not moved (same frame content), keep time of the actual move
+                return;
+            }
+            vx = (bx - x) / dt;
+            vy = (by - y) / dt;
+        }
+        x = bx;
+        y = by;
+        time = t;
+        count = min(2, count + 1);
+    }
+
+    bool ready() const
+    {
+        return count >= 2;
+    }
+
+    // straight on from the last move
+    void predict(Clock::time_point t, double& px, double& py) const
+    {
+        const double dt = chrono::duration<double>(t - time).count();
+        px = x + vx * dt;
+        py = y + vy * dt;
+    }
+};
+
+
+// what LatencyCalibrator learned on a host, kept between runs in $XDG_CONFIG_HOME/loopgrab/calibration
+// (~/.config if unset) as "<host> <latency us> <lead us> <hits>" lines
+struct Calibration
+{
+    Clock::duration latency = Clock::duration::zero();
+    Clock::duration lead = Clock::duration::zero();
+    uint64_t samples = 0;   // hits learned from, 0 if nothing learned yet
+
+    static string directory()
+    {
+        const char *config = getenv("XDG_CONFIG_HOME");
+        const char *home = getenv("HOME");
+        if (config != nullptr && *config != '\0')
+        {
+            return string(config) + "/loopgrab";
+        }
+        return home != nullptr ? string(home) + "/.config/loopgrab" : string();
+    }
+
+    static string host()
+    {
+        char name[256] = {};
+        if (gethostname(name, sizeof(name) - 1) != 0 || name[0] == '\0')
+        {
+            return "localhost";
+        }
+        return name;
+    }
+
+    // values of this host, if any
+    bool load()
+    {
+        const string dir = directory();
+        ifstream in(dir + "/calibration");
+        string name;
+        long long latencyUs;
+        long long leadUs;
+        uint64_t n;
+        while (!dir.empty() && in >> name >> latencyUs >> leadUs >> n)
+        {
+            if (name == host() && latencyUs >= 0 && leadUs >= 0)
+            {
+                latency = chrono::microseconds(latencyUs);
+                lead = chrono::microseconds(leadUs);
+                samples = n;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // replace the line of this host, keeping the others
+    bool save() const
+    {
+        const string dir = directory();
+        if (dir.empty())
+        {
+            return false;
+        }
+        mkdir(dir.substr(0, dir.rfind('/')).c_str(), 0755);
+        mkdir(dir.c_str(), 0755);
+
+        vector<string> lines;
+        {
+            ifstream in(dir + "/calibration");
+            string line;
+            while (getline(in, line))
+            {
+                if (!line.empty() && line.substr(0, line.find(' ')) != host())
+                {
+                    lines.push_back(line);
+                }
+            }
+        }
+
+        const string path = dir + "/calibration";
+        {
+            ofstream out(path + ".tmp");
+            for (const string& line : lines)
+            {
+                out << line << "\n";
+            }
+            out << host() << " " << chrono::duration_cast<chrono::microseconds>(latency).count()
+                << " " << chrono::duration_cast<chrono::microseconds>(lead).count() << " " << samples << "\n";
+            if (!out)
+            {
+                return false;
+            }
+        }
+        return rename((path + ".tmp").c_str(), path.c_str()) == 0;
+    }
+};
+
+
+// learns from fire outcomes during play, as medians of the last few:
+// - latency from a fire to the first frame showing its hit (the target arc moved away): the dead
+//   zone has to cover it, as the old arc stays on screen that long
+// - lead that would have landed a predicted fire right on its aim. The ball position when the key
+//   landed is the one in the hit frame, or for a miss the frame the hit was expected in, less the
+//   half frame the hit is seen late on average. Unlike the latency this also absorbs any bias of
+//   the prediction
+class LatencyCalibrator
+{
+    static const size_t window = 15;
+
+    deque<Clock::duration> latencies;
+    deque<Clock::duration> leads;
+    Calibration learned;
+    bool earlier;           // learned starts from an estimate of an earlier run
+    uint64_t added;         // hits this run
+
+    // median of the recent values, once there are enough to outvote an earlier estimate
+    void update(deque<Clock::duration>& recent, Clock::duration value, Clock::duration& estimate)
+    {
+        recent.push_back(value);
+        if (recent.size() > window)
+        {
+            recent.pop_front();
+        }
+        if (recent.size() >= 3 || !earlier)
+        {
+            vector<Clock::duration> sorted(recent.begin(), recent.end());
+            sort(sorted.begin(), sorted.end());
+            estimate = sorted[sorted.size() / 2];
+        }
+    }
+
+public:
+
+    LatencyCalibrator() :
+        earlier(false),
+        added(0)
+    {
+    }
+
+    // start from an earlier estimate, if any
+    void reset(const Calibration& calibration)
+    {
+        latencies.clear();
+        leads.clear();
+        learned = calibration;
+        earlier = calibration.samples > 0;
+        added = 0;
+    }
+
+    void addLatency(Clock::duration latency)
+    {
+        update(latencies, latency, learned.latency);
+        ++added;
+        ++learned.samples;
+    }
+
+    void addLead(Clock::duration lead)
+    {
+        update(leads, lead, learned.lead);
+    }
+
+    // a miss without a latency to tell where the key landed: half way back to the configured lead,
+    // which the next few samples outvote like an earlier estimate
+    void missed(Clock::duration configured)
+    {
+        learned.lead = configured + (learned.lead - configured) / 2;
+        leads.clear();
+        earlier = true;
+    }
+
+    bool ready() const
+    {
+        return learned.samples > 0;
+    }
+
+    bool leadReady() const
+    {
+        return earlier || !leads.empty();
+    }
+
+    // hits learned from during this run
+    uint64_t count() const
+    {
+        return added;
+    }
+
+    const Calibration& calibration() const
+    {
+        return learned;
+    }
+
+    Clock::duration lead() const
+    {
+        return learned.lead;
+    }
+
+    Clock::duration deadzone(Clock::duration frameInterval) const
+    {
+        return learned.latency + frameInterval / 2;
+    }
+};
+
+
+// HDR style log-linear histogram of nanosecond values: 16 linear buckets per power of two
+// (~6 % resolution) in fixed storage, so recording never allocates
+class LatencyHistogram
+{
+    static const int subBits = 4;
+    static const int sub = 1 << subBits;
+    static const int bucketCount = (64 - subBits + 1) * sub;
+
+    uint64_t buckets[bucketCount];
+    uint64_t total;
+    uint64_t maximum;
+
+    static int index(uint64_t v)
+    {
+        if (v < (uint64_t)sub)
+        {
+            return (int)v;
+        }
+        const int shift = 63 - __builtin_clzll(v) - subBits;
+        return (shift + 1) * sub + (int)((v >> shift) - sub);
+    }
+
+    // upper end of bucket i
+    static uint64_t value(int i)
+    {
+        if (i < sub)
+        {
+            return (uint64_t)i;
+        }
+        const int shift = i / sub - 1;
+        return ((uint64_t)(i % sub + sub + 1) << shift) - 1;
+    }
+
+public:
+
+    LatencyHistogram()
+    {
+        reset();
+    }
+
+    void reset()
+    {
+        memset(buckets, 0, sizeof(buckets));
+        total = 0;
+        maximum = 0;
+    }
+
+    void record(Clock::duration d)
+    {
+        const uint64_t ns = (uint64_t)std::max((Clock::rep)0, chrono::duration_cast<chrono::nanoseconds>(d).count());
+        ++buckets[index(ns)];
+        ++total;
+        maximum = std::max(maximum, ns);
+    }
+
+    uint64_t count() const
+    {
+        return total;
+    }
+
+    uint64_t max() const
+    {
+        return maximum;
+    }
+
+    // nanoseconds, p in [0, 1]
+    uint64_t percentile(double p) const
+    {
+        const uint64_t rank = (uint64_t)ceil(p * total);
+        uint64_t seen = 0;
+        for (int i = 0; i < bucketCount; ++i)
+        {
+            seen += buckets[i];
+            if (seen >= rank && seen > 0)
+            {
+                return std::min(value(i), maximum);
+            }
+        }
+        return 0;
+    }
+};
+
+
+class Instrumentation
+{
+public:
+
+    enum Stage
+    {
+        Capture,        // GameFrame::next()
+        FindBall,
+        Surrounded,     // isBallSurrounded()
+        Fire,           // GameControls::fire()
+        FrameToFire,    // capture start to fire injected
+        stageCount
+    };
+
+private:
+
+    LatencyHistogram stages[stageCount];
+    uint64_t frames;
+    uint64_t duplicates;    // frames not analysed, equal to the previous one
+    uint64_t windowHits[4]; // ball lost by the edge probes found at its predicted position, by window
+    uint64_t windowMisses;  // not found there either, fell back to ring and zone scans
+    Clock::time_point started;
+    Clock::time_point lastDump;
+
+    static const char* name(int stage)
+    {
+        static const char *names[stageCount] = {"capture", "find ball", "surrounded", "fire", "frame to fire"};
+        return names[stage];
+    }
+
+    static void micros(ostream& os, uint64_t ns)
+    {
+        os << fixedPoint(ns / 1000.0, 1) << "us";
+    }
+
+public:
+
+    Instrumentation() :
+        frames(0),
+        duplicates(0),
+        windowHits(),
+        windowMisses(0),
+        started(Clock::now()),
+        lastDump(started)
+    {
+    }
+
+    void record(Stage stage, Clock::duration d)
+    {
+        stages[stage].record(d);
+    }
+
+    void frame()
+    {
+        ++frames;
+    }
+
+    void duplicate()
+    {
+        ++duplicates;
+    }
+
+    // found by the predicted search window of the given widening step, 0 right at the prediction
+    void windowHit(int step)
+    {
+        ++windowHits[min(step, 3)];
+    }
+
+    void windowMiss()
+    {
+        ++windowMisses;
+    }
+
+    uint64_t windowHitCount() const
+    {
+        return windowHits[0] + windowHits[1] + windowHits[2] + windowHits[3];
+    }
+
+    uint64_t windowMissCount() const
+    {
+        return windowMisses;
+    }
+
+    void dump(ostream& os)
+    {
+        const auto now = Clock::now();
+        const double seconds = chrono::duration<double>(now - started).count();
+        lastDump = now;
+
+        os << dec << "stats: frames=" << frames << ", fps=" << fixedPoint(seconds > 0 ? frames / seconds : 0, 1)
+            << ", duplicates=" << duplicates << ", changed fps=" << fixedPoint(seconds > 0 ? (frames - duplicates) / seconds : 0, 1) << endl;
+        os << "  search window  hits=" << windowHitCount() << " (";
+        for (int i = 0; i < 4; ++i)
+        {
+            os << (i > 0 ? "/" : "") << windowHits[i];
+        }
+        os << " by step), fallbacks=" << windowMisses << endl;
+        for (int i = 0; i < stageCount; ++i)
+        {
+            const LatencyHistogram& h = stages[i];
+            os << "  " << left << setw(14) << name(i) << right << " n=" << h.count() << " p50=";
+            micros(os, h.percentile(0.5));
+            os << " p99=";
+            micros(os, h.percentile(0.99));
+            os << " max=";
+            micros(os, h.max());
+            os << endl;
+        }
+    }
+
+    // dump every interval, 0 never
+    void dumpPeriodically(ostream& os, Clock::duration interval)
+    {
+        if (interval.count() > 0 && Clock::now() - lastDump >= interval)
+        {
+            dump(os);
+        }
+    }
+};
+
+
+// encode width x height BGRX pixels as RGB PNG, row(y) returns row y, compression is the
+// zlib level (0-9, -1 default)
+static bool writePng(FILE *file, int width, int height, int compression, const function<const uint32_t*(int)>& row)
+{
+    png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+    png_infop info = png != nullptr ? png_create_info_struct(png) : nullptr;
+    if (info == nullptr)
+    {
+        png_destroy_write_struct(&png, nullptr);
+        return false;
+    }
+
+    if (setjmp(png_jmpbuf(png)))
+    {
+        png_destroy_write_struct(&png, &info);
+        return false;
+    }
+
+    png_init_io(png, file);
+    if (compression >= 0)
+    {
+        png_set_compression_level(png, compression);
+    }
+    png_set_IHDR(png, info, width, height, 8, PNG_COLOR_TYPE_RGB, PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+    png_write_info(png, info);
+    png_set_bgr(png);
+    png_set_filler(png, 0, PNG_FILLER_AFTER);   // drop the unused 4th byte
+
+    for (int y = 0; y < height; ++y)
+    {
+        png_write_row(png, reinterpret_cast<png_const_bytep>(row(y)));
+    }
+
+    png_write_end(png, nullptr);
+    png_destroy_write_struct(&png, &info);
+    return true;
+}
+
+
+// write width x height BGRX pixels to path, readRow(y, row) fills one row at a time
+static void savePng(const string& path, int width, int height, const function<void(int, uint32_t*)>& readRow)
+{
+    FILE *file = fopen(path.c_str(), "wb");
+    if (file == nullptr)
+    {
+        cerr << "error: failed to save PNG to " << path << ": " << strerror(errno) << endl;
+        return;
+    }
+
+    vector<uint32_t> pixels(width);
+    bool success = writePng(file, width, height, -1, [&](int y)
+    {
+        readRow(y, pixels.data());
+        return pixels.data();
+    });
+    fclose(file);
+
+    if (!success)
+    {
+        cerr << "error: failed to write PNG to " << path << endl;
+    }
+}
+
+
+// PNG snapshots encoded on a background thread: submit() only copies the frame into one of
+// a fixed set of preallocated buffers, snapshots are dropped while all of them are queued
+class SnapshotWriter
+{
+    struct Snapshot
+    {
+        string path;
+        int width;
+        int height;
+        vector<uint32_t> pixels;
+    };
+
+    const int compression;
+    vector<unique_ptr<Snapshot>> pool;      // free buffers
+    deque<unique_ptr<Snapshot>> queue;      // waiting to be encoded
+    mutex lock;
+    condition_variable ready;
+    bool stopping;
+    uint64_t written;
+    uint64_t dropped;
+    thread worker;
+
+    void run()
+    {
+        unique_lock<mutex> guard(lock);
+        for (;;)
+        {
+            ready.wait(guard, [this]() { return stopping || !queue.empty(); });
+            if (queue.empty())
+            {
+                return;
+            }
+
+            unique_ptr<Snapshot> snapshot = move(queue.front());
+            queue.pop_front();
+            guard.unlock();
+
+            const bool success = encode(*snapshot);
+
+            guard.lock();
+            if (success)
+            {
+                ++written;
+            }
+            pool.push_back(move(snapshot));
+        }
+    }
+
+    bool encode(const Snapshot& snapshot) const
+    {
+        FILE *file = fopen(snapshot.path.c_str(), "wb");
+        if (file == nullptr)
+        {
+            cerr << "error: failed to save PNG to " << snapshot.path << ": " << strerror(errno) << endl;
+            return false;
+        }
+
+        const bool success = writePng(file, snapshot.width, snapshot.height, compression, [&](int y)
+        {
+            return snapshot.pixels.data() + (size_t)y * snapshot.width;
+        });
+        fclose(file);
+
+        if (!success)
+        {
+            cerr << "error: failed to write PNG to " << snapshot.path << endl;
+        }
+        return success;
+    }
+
+public:
+
+    // buffers for up to depth snapshots of maxPixels each
+    SnapshotWriter(size_t maxPixels, int compression, int depth = 4) :
+        compression(compression),
+        stopping(false),
+        written(0),
+        dropped(0)
+    {
+        for (int i = 0; i < depth; ++i)
+        {
+            pool.emplace_back(new Snapshot());
+            pool.back()->path.reserve(256);
+            pool.back()->pixels.reserve(maxPixels);
+        }
+        worker = thread(&SnapshotWriter::run, this);
+    }
+
+    // writes all queued snapshots before returning
+    ~SnapshotWriter()
+    {
+        {
+            lock_guard<mutex> guard(lock);
+            stopping = true;
+        }
+        ready.notify_one();
+        worker.join();
+    }
+
+    // copy bounds of view (or of frame if there is no view) for writing to path, false if dropped
+    bool submit(const GameFrame& frame, const PixelView& view, const Rect& bounds, const string& path)
+    {
+        Rect r = bounds;
+        if (view.valid())
+        {
+            r.clip(view.bounds);
+        }
+        if (r.width() == 0 || r.height() == 0)
+        {
+            return false;
+        }
+
+        unique_ptr<Snapshot> snapshot;
+        {
+            lock_guard<mutex> guard(lock);
+            if (pool.empty())
+            {
+                ++dropped;
+                return false;
+            }
+            snapshot = move(pool.back());
+            pool.pop_back();
+        }
+
+        snapshot->path = path;
+        snapshot->width = r.width();
+        snapshot->height = r.height();
+        snapshot->pixels.resize((size_t)r.width() * r.height());
+        uint32_t *out = snapshot->pixels.data();
+        if (view.valid())
+        {
+            for (int y = r.y0; y < r.y1; ++y, out += r.width())
+            {
+                memcpy(out, view.at(r.x0, y), r.width() * sizeof(uint32_t));
+            }
+        }
+        else
+        {
+            for (int y = r.y0; y < r.y1; ++y)
+            {
+                for (int x = r.x0; x < r.x1; ++x)
+                {
+                    *out++ = frame.getPixel(x, y).c;
+                }
+            }
+        }
+
+        {
+            lock_guard<mutex> guard(lock);
+            queue.push_back(move(snapshot));
+        }
+        ready.notify_one();
+        return true;
+    }
+
+    void dump(ostream& os)
+    {
+        lock_guard<mutex> guard(lock);
+        os << "snapshots: written=" << written << ", dropped=" << dropped << ", queued=" << queue.size() << endl;
+    }
+};
+
+
+// persistent worker threads: run() executes a job on all of them plus the caller and
+// returns when every one of them is done
+class WorkerPool
+{
+    vector<thread> workers;
+    mutex lock;
+    condition_variable wake;
+    condition_variable done;
+    const function<void(int)> *job;
+    unsigned generation;
+    int running;
+    bool stopping;
+
+    void work(int index)
+    {
+        unsigned seen = 0;
+        unique_lock<mutex> guard(lock);
+        for (;;)
+        {
+            wake.wait(guard, [&]() { return stopping || generation != seen; });
+            if (stopping)
+            {
+                return;
+            }
+            seen = generation;
+            const function<void(int)>& current = *job;
+            guard.unlock();
+
+            current(index);
+
+            guard.lock();
+            if (--running == 0)
+            {
+                done.notify_one();
+            }
+        }
+    }
+
+public:
+
+    // threads including the caller of run()
+    WorkerPool(int threads) :
+        job(nullptr),
+        generation(0),
+        running(0),
+        stopping(false)
+    {
+        for (int i = 1; i < threads; ++i)
+        {
+            workers.emplace_back(&WorkerPool::work, this, i);
+        }
+    }
+
+    ~WorkerPool()
+    {
+        {
+            lock_guard<mutex> guard(lock);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& worker : workers)
+        {
+            worker.join();
+        }
+    }
+
+    int size() const
+    {
+        return (int)workers.size() + 1;
+    }
+
+    // thread running job(index), for index in [1, size())
+    thread& worker(int index)
+    {
+        return workers[index - 1];
+    }
+
+    // job(index) with index 0 on the calling thread
+    void run(const function<void(int)>& work)
+    {
+        {
+            lock_guard<mutex> guard(lock);
+            job = &work;
+            running = (int)workers.size();
+            ++generation;
+        }
+        wake.notify_all();
+
+        work(0);
+
+        unique_lock<mutex> guard(lock);
+        done.wait(guard, [this]() { return running == 0; });
+    }
+};
+
+
+class Game
+{
+    friend class GameBench;
+
+public:
+
+    static inline const Pixel fieldColor = {0xf6, 0xf9, 0xfb, 0x00};
+    static inline const Pixel ballColor = {0x51, 0x3d, 0x2c, 0x00};
+
+    // classes of Palette
+    static const uint8_t otherClass = 0;
+    static const uint8_t fieldClass = 1;
+    static const uint8_t ballClass = 2;
+
+private:
+
+    // pixels [x0, x1) of a row
+    struct Run
+    {
+        int x0;
+        int x1;
+    };
+
+    GameControls& controls;
+    const int width;
+    const int height;
+    Rect screen;
+    Rect zone;                      // of the screen the field is searched in
+    Rect ball;                      // inclusive
+    double ballX;                   // centroid of the ball pixels, sub-pixel ball position
+    double ballY;
+    BallMotion motion;              // of the ball center, where to look first when it moved far
+    Rect field;
+    vector<Run> fieldMask;          // where the ball can be: left and right run of each row from maskY0, empty if not built
+    int maskY0;
+    vector<Point> fieldTrail;       // ball centers seen while determining the field
+    bool fieldClosed;               // trail runs around the field center, the field is complete
+    int frameCount;
+    int lastFire;
+    Clock::time_point frameTime;    // of the current frame, all game timing runs on the frame clock
+    Clock::time_point lastFireTime;
+    Clock::time_point lastBall;
+    Clock::time_point lastBallMove;
+    int deadzoneFrames;
+    Clock::duration deadzone;       // minimum time between fires, in addition to deadzoneFrames
+    Clock::duration stallTimeout;   // stop after the ball didn't move for this long
+    Clock::duration lostTimeout;    // stop after the ball wasn't seen for this long
+    int ignoredCount;
+    bool hasFired;
+    PixelView view;
+    Palette palette;                // of fieldColor and ballColor
+
+    // predictive firing
+    bool predictive;
+    Clock::duration lead;           // fire this much ahead to compensate capture + input latency
+    Clock::duration configuredLead; // lead before calibration
+    Trajectory trajectory;
+    double trackRadius;
+    Clock::duration frameInterval;
+    bool fireScheduled;
+    Clock::time_point fireAt;
+    double fireAim;                 // unwrapped ball angle the pending or last fire aims for
+    double fireArcMiddle;           // unwrapped angles of the target arc fired at
+    double fireArcEnd;
+
+    // online calibration: the arc fired at is watched for the hit, its latency sets lead and dead zone
+    bool calibrating;
+    LatencyCalibrator calibrator;
+    double watchAngles[3];          // track angles of points on the arc fired at
+    int watchCount;                 // 0 if not watching
+    Clock::time_point watchSince;   // frame time of the fire
+    bool watchPredicted;            // fire aimed at watchAim, went with a frame watchLate after it was due
+    double watchAim;
+    Clock::duration watchLead;
+    Clock::duration watchLate;
+    bool watchExpected;             // frame the hit was due in (by the learned latency) seen, ball at watchBall
+    double watchBall;
+    bool fireAimed;                 // scheduled fire aims at the arc (not fired at once, the arc start unknown)
+
+    Instrumentation stats;
+    Clock::time_point frameStart;
+    static inline thread_local uint64_t touched = 0;   // pixels read by this thread, for benchmarks
+    WorkerPool *pool;               // for parallel zone scans, if set
+
+    SnapshotWriter *snapshots;      // evidence of fire and game over frames, if set
+    string snapshotPrefix;
+
+    // ring track the ball runs on, calibrated once the field is known
+    double ringX;
+    double ringY;
+    double ringRadius;              // 0 if not calibrated
+    vector<Point> ring;             // track samples at half ball width spacing, by angle
+    vector<int32_t> ringOffsets;    // of ring pixels in the view, empty if it doesn't cover the ring
+    int ringStride;                 // view layout ringOffsets were computed for
+    Rect ringBounds;
+
+    // target arc on the ring as angle interval, only changes after a hit
+    bool arcValid;                  // confirmed by two equal detections and unchanged since
+    bool arcDetected;
+    double arcStart;                // [0, 2 pi)
+    double arcLength;               // 0: no target
+    vector<uint8_t> arcSamples;     // classes of few ring pixels at detection, any change invalidates the arc
+
+    // change detection: hash of the ring and the ball's neighborhood, frames hashing equal are not analysed
+    vector<int32_t> hashOffsets;
+    uint64_t lastHash;
+    Rect hashedBall;                // ball position the neighborhood in lastHash is around
+    bool hashValid;
+    bool lastFound;                 // ball found in the last analysed frame
+
+    void limit(Rect& r)
+    {
+        r.x0 = min(r.x1, min(width, max(0, r.x0)));
+        r.y0 = min(r.y1, min(height, max(0, r.y0)));
+        r.x1 = max(r.x0, min(width, max(0, r.x1)));
+        r.y1 = max(r.y0, min(height, max(0, r.y1)));
+    }
+
+    bool shrink(Rect& r)
+    {
+        r.x0 = r.x0 + 1;
+        r.y0 = r.y0 + 1;
+        r.x1 = r.x1 - 1;
+        r.y1 = r.y1 - 1;
+
+        limit(r);
+
+        return r.x0 != r.x1 || r.y0 != r.y1;
+    }
+
+    bool expand(Rect& r)
+    {
+        r.x0 = r.x0 - 1;
+        r.y0 = r.y0 - 1;
+        r.x1 = r.x1 + 1;
+        r.y1 = r.y1 + 1;
+
+        limit(r);
+
+        return r.x0 != 0 || r.y0 != 0 || r.x1 != width || r.y1 != height;
+    }
+
+    Pixel pixel(const GameFrame& frame, int x, int y) const
+    {
+        ++touched;
+        if (view.valid())
+        {
+            return view.bounds.contains(x, y) ? Pixel(*view.at(x, y)) : Pixel();
+        }
+        return frame.getPixel(x, y);
+    }
+
+    // first x in [x0, x1) of row y of class cls, x1 if there is none
+    int findClassInRow(const GameFrame& frame, int y, int x0, int x1, uint8_t cls) const
+    {
+        if (view.valid())
+        {
+            Rect s(x0, y, x1, y + 1);
+            s.clip(view.bounds);
+            if (s.width() == 0 || s.height() == 0)
+            {
+                return x1;
+            }
+            const int i = palette.find(view.at(s.x0, s.y0), s.width(), 1, cls);
+            touched += min(i + 1, s.width());
+            return i < s.width() ? s.x0 + i : x1;
+        }
+
+        for (int x = x0; x < x1; ++x)
+        {
+            ++touched;
+            if (palette.is(frame.getPixel(x, y), cls))
+            {
+                return x;
+            }
+        }
+        return x1;
+    }
+
+    // last x of the run of class cls through (x, y) in direction dir
+    int runEnd(const GameFrame& frame, int y, int x, int dir, uint8_t cls) const
+    {
+        const int limit = dir < 0 ? 0 : width - 1;
+        if (view.valid() && view.bounds.contains(x, y))
+        {
+            const uint32_t *p = view.at(x, y);
+            if (dir > 0)
+            {
+                const int n = min(limit, view.bounds.x1 - 1) - x;
+                const int i = palette.skip(p + 1, n, cls);
+                touched += min(i + 1, n);
+                return x + i;
+            }
+
+            // runs rarely grow much to the left of where the search hit them
+            const int n = x - max(limit, view.bounds.x0);
+            int i = 0;
+            while (i < n && palette.is(Pixel(p[-i - 1]), cls))
+            {
+                ++i;
+            }
+            touched += min(i + 1, n);
+            return x - i;
+        }
+
+        int e = x;
+        while (e != limit && palette.is(pixel(frame, e + dir, y), cls))
+        {
+            e += dir;
+        }
+        return e;
+    }
+
+    // runs of class cls in row y that start or pass through [x0, x1), appended in order from x
+    // (so runs found from several runs of the previous row are not repeated)
+    void findRuns(const GameFrame& frame, int y, int x0, int x1, uint8_t cls, vector<Run>& runs)
+    {
+        int x = max(0, max(x0, runs.empty() ? 0 : runs.back().x1 + 1));
+        const int end = min(width, x1);
+        while (x < end)
+        {
+            // runs of the next row of a blob mostly start right at the previous ones
+            if (!palette.is(pixel(frame, x, y), cls))
+            {
+                x = findClassInRow(frame, y, x + 1, end, cls);
+            }
+            if (x == end)
+            {
+                break;
+            }
+
+            const int l = runEnd(frame, y, x, -1, cls);
+            const int r = runEnd(frame, y, x, 1, cls) + 1;
+            runs.push_back(Run{l, r});
+            x = r + 1;
+        }
+    }
+
+    // 8-connected component of class cls at (x, y) in a single pass over its row runs, growing down
+    // then up from the seed row: bounds, pixel count and centroid. Gives up on components
+    // larger than maxSize (not a ball), blob then holds the part seen
+    bool extractComponent(const GameFrame& frame, int x, int y, uint8_t cls, int maxSize, Blob& blob)
+    {
+        static thread_local vector<Run> current;
+        static thread_local vector<Run> next;
+
+        if (x < 0 || x >= width || y < 0 || y >= height || !palette.is(pixel(frame, x, y), cls))
+        {
+            return false;
+        }
+
+        int64_t sumX = 0;
+        int64_t sumY = 0;
+        blob.bounds = Rect(x, y, x, y);
+        blob.pixels = 0;
+        auto add = [&](const Run& run, int row)
+        {
+            const int n = run.x1 - run.x0;
+            blob.bounds.x0 = min(blob.bounds.x0, run.x0);
+            blob.bounds.x1 = max(blob.bounds.x1, run.x1 - 1);
+            blob.bounds.y0 = min(blob.bounds.y0, row);
+            blob.bounds.y1 = max(blob.bounds.y1, row);
+            blob.pixels += n;
+            sumX += (int64_t)(run.x0 + run.x1 - 1) * n / 2;
+            sumY += (int64_t)row * n;
+        };
+
+        current.clear();
+        findRuns(frame, y, x, x + 1, cls, current);
+        const Run seed = current.front();
+        add(seed, y);
+
+        for (int dir : {1, -1})
+        {
+            current.assign(1, seed);
+            for (int row = y + dir; !current.empty() && row >= 0 && row < height; row += dir)
+            {
+                next.clear();
+                for (const Run& run : current)
+                {
+                    findRuns(frame, row, run.x0 - 1, run.x1 + 1, cls, next);
+                }
+                for (const Run& run : next)
+                {
+                    add(run, row);
+                }
+                if (blob.bounds.width() > maxSize || blob.bounds.height() > maxSize)
+                {
+                    return false;
+                }
+                swap(current, next);
+            }
+        }
+
+        blob.x = (double)sumX / blob.pixels;
+        blob.y = (double)sumY / blob.pixels;
+        return true;
+    }
+
+    bool isBallSurrounded(const GameFrame& frame, const Rect& ball)
+    {
+        Rect f = ball;
+
+        // need ball frame (2 pixels outside for safety)
+        expand(f); 
+        expand(f);
+        expand(f);
+
+        return !palette.is(pixel(frame, f.centerX(), f.y0), fieldClass)
+            && !palette.is(pixel(frame, f.centerX(), f.y1), fieldClass)
+            && !palette.is(pixel(frame, f.x0, f.centerY()), fieldClass)
+            && !palette.is(pixel(frame, f.x1, f.centerY()), fieldClass);
+    }
+
+    bool checkForBall(const GameFrame& frame, int x, int y, Blob& b)
+    {
+        if (!extractComponent(frame, x, y, ballClass, max(64, min(width, height) / 4), b))
+        {
+            return false;
+        }
+
+        // a square and at least 5x5?
+        const int width = b.bounds.width();
+        const int height = b.bounds.height();
+        if (width <= 4 || width != height)
+        {
+            return false;
+        }
+
+        // round: a disc fills ~pi/4 of its box (less for small ones, a filled square 1),
+        // with its centroid in the middle
+        const double fill = (double)b.pixels / ((width + 1) * (height + 1));
+        return fill > 0.5 && fill < 0.9
+            && fabs(b.x - (b.bounds.x0 + b.bounds.x1) / 2.0) <= 1
+            && fabs(b.y - (b.bounds.y0 + b.bounds.y1) / 2.0) <= 1;
+    }
+
+    // parts of row y in [x0, x1) the ball can be in: all of it without a field mask
+    int maskedRuns(int y, int x0, int x1, Run (&runs)[2]) const
+    {
+        if (fieldMask.empty())
+        {
+            runs[0] = Run{x0, x1};
+            return x0 < x1 ? 1 : 0;
+        }
+
+        const int i = 2 * (y - maskY0);
+        if (i < 0 || i >= (int)fieldMask.size())
+        {
+            return 0;
+        }
+        int n = 0;
+        for (int k = 0; k < 2; ++k)
+        {
+            const Run r{max(x0, fieldMask[i + k].x0), min(x1, fieldMask[i + k].x1)};
+            if (r.x0 < r.x1)
+            {
+                runs[n++] = r;
+            }
+        }
+        return n;
+    }
+
+    // visit zone on a grid of stepX * stepY pixels, skipping candidates inside b (last ball or rejected blob)
+    // and outside the field mask
+    bool scanForBall(const GameFrame& frame, const Rect& zone, int stepX, int stepY, Blob& b)
+    {
+        Run runs[2];
+        if (!view.valid())
+        {
+            for (int y = zone.y0; y < zone.y1; y += stepY)
+            {
+                const int n = maskedRuns(y, zone.x0, zone.x1, runs);
+                for (int r = 0; r < n; ++r)
+                {
+                    for (int x = zone.x0 + ((runs[r].x0 - zone.x0 + stepX - 1) / stepX) * stepX; x < runs[r].x1; x += stepX)
+                    {
+                        if (!b.bounds.contains(x, y) && checkForBall(frame, x, y, b))
+                        {
+                            return true;
+                        }
+                    }
+                }
+            }
+            return false;
+        }
+
+        // only grid points inside the view can match
+        Rect z = zone;
+        z.clip(view.bounds);
+        const int y0 = zone.y0 + ((max(0, z.y0 - zone.y0) + stepY - 1) / stepY) * stepY;
+        for (int y = y0; y < z.y1; y += stepY)
+        {
+            const int m = maskedRuns(y, z.x0, z.x1, runs);
+            for (int r = 0; r < m; ++r)
+            {
+                const int x1 = runs[r].x1;
+                int x = zone.x0 + ((runs[r].x0 - zone.x0 + stepX - 1) / stepX) * stepX;
+                while (x < x1)
+                {
+                    const int n = (x1 - x + stepX - 1) / stepX;
+                    const int i = palette.find(view.at(x, y), n, stepX, ballClass);
+                    touched += min(i + 1, n);
+                    if (i == n)
+                    {
+                        break;
+                    }
+
+                    x += i * stepX;
+                    if (!b.bounds.contains(x, y) && checkForBall(frame, x, y, b))
+                    {
+                        return true;
+                    }
+                    x += stepX;
+                }
+            }
+        }
+        return false;
+    }
+
+    // scanForBall() on tiles of the zone by all threads of the pool. Tiles are taken in order and
+    // workers stop at the first ball, so lower tiles are done and the result is the serial one
+    bool parallelScanForBall(const GameFrame& frame, const Rect& zone, int stepX, int stepY, Blob& b)
+    {
+        // waking the workers costs more than small scans
+        const int64_t points = (int64_t)(zone.width() / stepX) * (zone.height() / stepY);
+        if (pool == nullptr || pool->size() < 2 || !view.valid() || points < (1 << 15))
+        {
+            return scanForBall(frame, zone, stepX, stepY, b);
+        }
+
+        // ~64 KB of rows per tile, on the grid of the zone
+        const int tileRows = max(1, (16384 / max(1, zone.width()) + stepY - 1) / stepY) * stepY;
+        const int tiles = (zone.height() + tileRows - 1) / tileRows;
+        atomic<int> nextTile(0);
+        atomic<bool> found(false);
+        atomic<uint64_t> workerTouched(0);
+        mutex resultLock;
+        int resultTile = tiles;
+        Blob result;
+        const Blob start = b;
+
+        pool->run([&](int worker)
+        {
+            const uint64_t before = touched;
+            while (!found.load(memory_order_relaxed))
+            {
+                const int t = nextTile++;
+                if (t >= tiles)
+                {
+                    break;
+                }
+
+                const Rect tile(zone.x0, zone.y0 + t * tileRows, zone.x1, min(zone.y1, zone.y0 + (t + 1) * tileRows));
+                Blob r = start;
+                if (scanForBall(frame, tile, stepX, stepY, r))
+                {
+                    lock_guard<mutex> guard(resultLock);
+                    if (t < resultTile)
+                    {
+                        resultTile = t;
+                        result = r;
+                    }
+                    found = true;
+                }
+            }
+            if (worker != 0)
+            {
+                workerTouched += touched - before;
+            }
+        });
+
+        touched += workerTouched;
+        if (resultTile < tiles)
+        {
+            b = result;
+            return true;
+        }
+        return false;
+    }
+
+    // ball of unknown size: checkForBall() only accepts balls wider than 4 pixels, whose
+    // inner 5x5 square always holds a pixel of the 4 pixel grid. Coarse to fine: the 16 pixel
+    // grid (1/256 of the pixels) finds bigger balls, the 4 pixel grid (1/16) any ball
+    bool coldScanForBall(const GameFrame& frame, const Rect& zone, Blob& b)
+    {
+        for (int step : {16, 4})
+        {
+            b = Blob(ball);
+            if (parallelScanForBall(frame, zone, step, step, b))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // sample the track circle every half ball width, so the ball always covers a sample
+    void setRing(double x, double y, double radius)
+    {
+        ringX = x;
+        ringY = y;
+        ringRadius = radius;
+        ring.clear();
+        ringOffsets.clear();
+        ringStride = 0;
+
+        const double spacing = max(1, ball.width() / 2);
+        const int n = (int)ceil(twoPi * radius / spacing);
+        for (int i = 0; i < n; ++i)
+        {
+            const double a = twoPi * i / n;
+            ring.push_back(Point((int)lround(x + radius * cos(a)), (int)lround(y + radius * sin(a))));
+        }
+    }
+
+    // field (before the safety margin) is the bounding box of the ball positions seen,
+    // so its center and size minus the ball give the circle the ball center runs on
+    void calibrateRing()
+    {
+        const double radius = ((field.width() + field.height()) / 2.0 - ball.width()) / 2.0;
+        setRing((field.x0 + field.x1) / 2.0, (field.y0 + field.y1) / 2.0, radius);
+        trackRadius = radius;
+        cerr << "[" << frameCount << "] ring: center=(" << ringX << ", " << ringY << "), radius=" << ringRadius << ", samples=" << ring.size() << endl;
+    }
+
+    // rows of the field the ball can cover on the calibrated ring: the annulus of a ball width to either
+    // side of the track (the ball's radius and as much again for calibration error), which leaves out
+    // the corners and the empty center
+    void maskField()
+    {
+        fieldMask.clear();
+        maskY0 = field.y0;
+        const double reach = ball.width() + 1;
+        const double outer = ringRadius + reach;
+        const double inner = max(0.0, ringRadius - reach);
+        int64_t covered = 0;
+        for (int y = field.y0; y < field.y1; ++y)
+        {
+            const double dy = fabs(y - ringY);
+            Run left{field.x0, field.x0};
+            Run right{field.x1, field.x1};
+            if (dy <= outer)
+            {
+                const double o = sqrt(outer * outer - dy * dy);
+                const double i = dy < inner ? sqrt(inner * inner - dy * dy) : 0;
+                left.x0 = max(field.x0, (int)floor(ringX - o));
+                left.x1 = max(left.x0, min(field.x1, (int)floor(ringX - i) + 1));
+                right.x1 = min(field.x1, (int)ceil(ringX + o) + 1);
+                right.x0 = min(right.x1, max(left.x1, (int)ceil(ringX + i)));
+            }
+            fieldMask.push_back(left);
+            fieldMask.push_back(right);
+            covered += (left.x1 - left.x0) + (right.x1 - right.x0);
+        }
+        cerr << "[" << frameCount << "] field mask: " << covered << " of " << (int64_t)field.width() * field.height() << " pixels" << endl;
+    }
+
+    // ring pixel offsets relative to the view origin, only depend on the view layout
+    void updateRingOffsets()
+    {
+        if (view.stride == ringStride && view.bounds == ringBounds)
+        {
+            return;
+        }
+        ringStride = view.stride;
+        ringBounds = view.bounds;
+        ringOffsets.clear();
+        for (const Point& p : ring)
+        {
+            if (!view.bounds.contains(p.x, p.y))
+            {
+                ringOffsets.clear();
+                return;
+            }
+            ringOffsets.push_back((int32_t)((p.y - view.bounds.y0) * view.pitch() + (p.x - view.bounds.x0)));
+        }
+    }
+
+    // hash of the ring (or a sparse grid if the view doesn't cover it) and every pixel around the ball
+    uint64_t hashFrame()
+    {
+        updateRingOffsets();
+        hashOffsets = ringOffsets;
+        const Rect& v = view.bounds;
+        if (hashOffsets.empty())
+        {
+            for (int y = v.y0; y < v.y1; y += 8)
+            {
+                for (int x = v.x0; x < v.x1; x += 8)
+                {
+                    hashOffsets.push_back((int32_t)((y - v.y0) * view.pitch() + (x - v.x0)));
+                }
+            }
+        }
+
+        Rect around(ball.x0 - 2, ball.y0 - 2, ball.x1 + 3, ball.y1 + 3);
+        around.clip(v);
+        for (int y = around.y0; y < around.y1; ++y)
+        {
+            for (int x = around.x0; x < around.x1; ++x)
+            {
+                hashOffsets.push_back((int32_t)((y - v.y0) * view.pitch() + (x - v.x0)));
+            }
+        }
+
+        const int n = (int)hashOffsets.size();
+        touched += n;
+        uint64_t h = hashPixels(view.at(v.x0, v.y0), hashOffsets.data(), n);
+        h = (h ^ (uint64_t)view.stride) * 0x100000001b3ull;
+        h = (h ^ ((uint64_t)(uint32_t)v.x0 << 32 | (uint32_t)v.y0)) * 0x100000001b3ull;
+        h = (h ^ ((uint64_t)(uint32_t)v.x1 << 32 | (uint32_t)v.y1)) * 0x100000001b3ull;
+        hashedBall = ball;
+        return h;
+    }
+
+    // whether the frame shows the same as the last one around the ring and the ball,
+    // so neither the ball nor the target can have moved
+    bool unchanged(const GameFrame& frame)
+    {
+        if (frame.repeated())
+        {
+            return hashValid;
+        }
+        if (!view.valid() || view.bounds.width() <= 0 || view.bounds.height() <= 0)
+        {
+            hashValid = false;
+            return false;
+        }
+
+        const bool comparable = hashValid && hashedBall == ball;
+        const uint64_t h = hashFrame();
+        const bool same = comparable && h == lastHash;
+        lastHash = h;
+        hashValid = true;
+        return same;
+    }
+
+    // keep the hash comparable with the next frame when detection moved the ball
+    void rehash()
+    {
+        if (hashValid && !(hashedBall == ball))
+        {
+            lastHash = hashFrame();
+        }
+    }
+
+    // search along the ring, starting where the ball was last seen
+    bool scanRingForBall(const GameFrame& frame, Blob& b)
+    {
+        updateRingOffsets();
+        const int n = (int)ringOffsets.size();
+        if (n == 0)
+        {
+            return false;
+        }
+
+        const uint32_t *base = view.at(view.bounds.x0, view.bounds.y0);
+        double a = atan2(b.y - ringY, b.x - ringX);
+        if (a < 0)
+        {
+            a += twoPi;
+        }
+        const int start = (int)(a / twoPi * n) % n;
+
+        for (int part = 0; part < 2; ++part)
+        {
+            int i = part == 0 ? start : 0;
+            const int end = part == 0 ? n : start;
+            while (i < end)
+            {
+                const int k = palette.findIndexed(base, ringOffsets.data() + i, end - i, ballClass);
+                touched += min(k + 1, end - i);
+                i += k;
+                if (i == end)
+                {
+                    break;
+                }
+
+                const Point& p = ring[i];
+                if (!b.bounds.contains(p.x, p.y) && checkForBall(frame, p.x, p.y, b))
+                {
+                    return true;
+                }
+                ++i;
+            }
+        }
+        return false;
+    }
+
+    void setBall(const Blob& b)
+    {
+        ball = b.bounds;
+        ballX = b.x;
+        ballY = b.y;
+        lastBall = frameTime;
+        motion.add(b.x, b.y, frameTime);
+    }
+
+    // ball moved too far for the edge probes: look where its last move predicts it (on the ring once
+    // that is calibrated), then on windows of 2, 4 and 8 ball widths around that, each scanning only
+    // its border outside the one before, so fast balls don't fall back to the ring and zone scans
+    bool findPredictedBall(const GameFrame& frame, const Rect& zone, Blob& b)
+    {
+        if (!motion.ready() || ball.width() == 0)
+        {
+            return false;
+        }
+
+        double px;
+        double py;
+        motion.predict(frameTime, px, py);
+        const double dx = px - ringX;
+        const double dy = py - ringY;
+        const double r = sqrt(dx * dx + dy * dy);
+        if (ringRadius > 0 && r > 0)
+        {
+            px = ringX + dx * ringRadius / r;
+            py = ringY + dy * ringRadius / r;
+        }
+
+        // b stays the last ball for the scans after a miss
+        Blob candidate = b;
+        const int x = (int)lround(px);
+        const int y = (int)lround(py);
+        if (zone.contains(x, y) && !b.bounds.contains(x, y) && checkForBall(frame, x, y, candidate))
+        {
+            stats.windowHit(0);
+            b = candidate;
+            return true;
+        }
+
+        const int step = max(1, ball.width() / 2);
+        auto onGrid = [&](int v, int origin)
+        {
+            const int offset = (v - origin) % step;
+            return offset > 0 ? v + step - offset : v - offset;
+        };
+        Rect inner(x, y, x, y);
+        inner.clip(zone);
+        for (int i = 1; i <= 3; ++i)
+        {
+            const int half = ball.width() << (i - 1);
+            Rect window(x - half, y - half, x + half + 1, y + half + 1);
+            window.clip(zone);
+            // above, below, left and right of the inner window (clipped the same, so inside this one)
+            const Rect strips[4] = {Rect(window.x0, window.y0, window.x1, inner.y0), Rect(window.x0, inner.y1, window.x1, window.y1),
+                Rect(window.x0, inner.y0, inner.x0, inner.y1), Rect(inner.x1, inner.y0, window.x1, inner.y1)};
+            for (const Rect& strip : strips)
+            {
+                // on one grid through the prediction: separate grids could leave gaps of almost a
+                // ball width at the strip edges
+                const Rect grid(min(strip.x1, onGrid(strip.x0, x)), min(strip.y1, onGrid(strip.y0, y)), strip.x1, strip.y1);
+                if (scanForBall(frame, grid, step, step, candidate))
+                {
+                    stats.windowHit(i);
+                    b = candidate;
+                    return true;
+                }
+            }
+            inner = window;
+        }
+
+        stats.windowMiss();
+        return false;
+    }
+
+    bool findBall(const GameFrame& frame, const Rect& zone)
+    {
+        Blob b(ball);
+        if (checkForBall(frame, ball.centerX(), ball.y0, b)
+            || checkForBall(frame, ball.x0, ball.centerY(), b)
+            || checkForBall(frame, ball.centerX(), ball.y1, b)
+            || checkForBall(frame, ball.x1, ball.centerY(), b))
+        {
+            if (ball != b.bounds)
+            {
+                //cerr << "ball follow: " << b.bounds << endl;
+                lastBallMove = frameTime;
+            }
+            else
+            {
+                //cerr << "ball stuck: " << b.bounds << endl;
+            }
+            setBall(b);
+            return true;
+        }
+
+        // try to find ball where it should be by now, on the ring, then anywhere in the zone
+        b = Blob(ball);
+        if (findPredictedBall(frame, zone, b)
+            || (ringRadius > 0 && view.valid() && scanRingForBall(frame, b))
+            || (ball.width() == 0 && coldScanForBall(frame, zone, b))
+            || (ball.width() > 0 && parallelScanForBall(frame, zone, max(1, ball.width() / 2), max(1, ball.height() / 2), b)))
+        {
+            // cerr << "ball new: " << b.bounds << endl;
+            setBall(b);
+            lastBallMove = frameTime;
+            return true;
+        }
+
+        return false;
+    }
+
+    // did we already identify the playing field boundaries for this game?
+    bool haveField() const
+    {
+        return fieldClosed;
+    }
+
+    // large and square like the whole track, but so is a quarter of it (which never
+    // reaches the quadrant opposite of its bulge), so the ball must have been all around
+    bool fieldComplete() const
+    {
+        int unit = max(4, ball.width());
+        if (field.width() <= unit * 10
+            || field.height() <= unit * 10
+            || field.width() >= field.height() + (unit / 4)
+            || field.width() <= field.height() - (unit / 4))
+        {
+            return false;
+        }
+
+        const int cx = field.x0 + field.x1;
+        const int cy = field.y0 + field.y1;
+        int quadrants = 0;
+        for (const Point& p : fieldTrail)
+        {
+            quadrants |= 1 << ((2 * p.x > cx ? 1 : 0) + (2 * p.y > cy ? 2 : 0));
+        }
+        return quadrants == 0xf;
+    }
+
+    bool expandField(const GameFrame& frame)
+    {
+        // while determining field, always search the whole zone
+        if (!findBall(frame, zone))
+        {
+            if (field.x1 == 0)
+            {
+                cerr << "error: no ball found: proof saved to no-ball-proof.png" << endl;
+                frame.savePng("no-ball-proof.png");
+                return false;
+            }
+            return true;
+        }
+
+        if (field.x1 == 0)
+        {
+            // initialize
+            field = ball;
+        }
+        else
+        {
+            // add current ball to field (search area)
+            field.add(ball);
+        }
+        fieldTrail.push_back(Point(ball.centerX(), ball.centerY()));
+        fieldClosed = fieldComplete();
+        if (fieldClosed)
+        {
+            fieldTrail = vector<Point>();
+        }
+
+        return true;
+    }
+
+    void addFieldSafetyMargin()
+    {
+        for (int i = 0; i < ball.width(); ++i)
+        {
+            expand(field);
+        }
+    }
+
+    double trackX() const
+    {
+        return ringRadius > 0 ? ringX : (field.x0 + field.x1) / 2.0;
+    }
+
+    double trackY() const
+    {
+        return ringRadius > 0 ? ringY : (field.y0 + field.y1) / 2.0;
+    }
+
+    void trackBall(Clock::time_point now)
+    {
+        const double dx = ballX - trackX();
+        const double dy = ballY - trackY();
+        const double r = sqrt(dx * dx + dy * dy);
+        trackRadius = trackRadius > 0 ? 0.9 * trackRadius + 0.1 * r : r;
+        trajectory.add(atan2(dy, dx), now);
+    }
+
+    Pixel trackPixel(const GameFrame& frame, double angle) const
+    {
+        return pixel(frame, (int)lround(trackX() + trackRadius * cos(angle)), (int)lround(trackY() + trackRadius * sin(angle)));
+    }
+
+    // next target arc along the track, searching from angle "from" in direction dir, skipping the first skip radians.
+    // start and end are returned as distance (radians) from "from".
+    bool findTargetArc(const GameFrame& frame, double from, int dir, double skip, double& start, double& end) const
+    {
+        const double step = 1.0 / trackRadius;    // ~1 pixel
+        const int minRun = 3;                     // ignore anti-aliasing specks
+        int run = 0;
+        for (double d = skip; d < twoPi; d += step)
+        {
+            const Pixel p = trackPixel(frame, from + dir * d);
+            if (palette.classOf(p) == otherClass)
+            {
+                if (run++ == 0)
+                {
+                    start = d;
+                }
+            }
+            else if (run >= minRun)
+            {
+                end = d;
+                return true;
+            }
+            else
+            {
+                run = 0;
+            }
+        }
+
+        if (run >= minRun)
+        {
+            end = twoPi;
+            return true;
+        }
+        return false;
+    }
+
+    // angle in [0, 2 pi)
+    static double wrapAngle(double a)
+    {
+        a = fmod(a, twoPi);
+        return a < 0 ? a + twoPi : a;
+    }
+
+    // angle of the ball center on the ring
+    double ballAngle() const
+    {
+        return atan2(ballY - ringY, ballX - ringX);
+    }
+
+    void invalidateArc()
+    {
+        arcValid = false;
+        arcDetected = false;
+    }
+
+    // scan the whole ring (~1 pixel steps) for the target arc, ball pixels continue a run
+    // (ball may cover an arc end). length 0 if there is none, false if there are several
+    bool detectTargetArc(const GameFrame& frame, double& start, double& length) const
+    {
+        const int n = (int)ceil(twoPi * ringRadius);
+        const int minRun = 3;   // ignore anti-aliasing specks
+        auto at = [&](int i)
+        {
+            const double a = twoPi * i / n;
+            return pixel(frame, (int)lround(ringX + ringRadius * cos(a)), (int)lround(ringY + ringRadius * sin(a)));
+        };
+
+        // start on a field pixel, so no arc wraps around the scan
+        int first = 0;
+        while (first < n && !palette.is(at(first), fieldClass))
+        {
+            ++first;
+        }
+        if (first == n)
+        {
+            return false;
+        }
+
+        start = 0;
+        length = 0;
+        int arcs = 0;
+        int run = 0;            // target (or ball) pixels in the current run
+        int target = 0;         // target pixels in it
+        int runStart = 0;
+        for (int i = first; i <= first + n; ++i)
+        {
+            const uint8_t c = palette.classOf(at(i % n));
+            if (c != fieldClass)
+            {
+                if (run++ == 0)
+                {
+                    runStart = i;
+                }
+                if (c != ballClass)
+                {
+                    ++target;
+                }
+            }
+            else
+            {
+                if (target >= minRun)
+                {
+                    start = wrapAngle(twoPi * runStart / n);
+                    length = twoPi * run / n;
+                    ++arcs;
+                }
+                run = 0;
+                target = 0;
+            }
+        }
+        return arcs <= 1;
+    }
+
+    Point arcSample(int i) const
+    {
+        const double a = twoPi * i / 16;
+        return Point((int)lround(ringX + ringRadius * cos(a)), (int)lround(ringY + ringRadius * sin(a)));
+    }
+
+    // keep the cached target arc up to date: re-detect after a fire or when the ring samples
+    // not covered by the ball changed
+    void updateTargetArc(const GameFrame& frame)
+    {
+        if (ringRadius <= 0)
+        {
+            return;
+        }
+
+        Rect ballBox = ball;
+        expand(ballBox);
+        expand(ballBox);
+        if (arcValid)
+        {
+            for (size_t i = 0; i < arcSamples.size(); ++i)
+            {
+                const Point p = arcSample((int)i);
+                if (!ballBox.contains(p.x, p.y) && palette.classOf(pixel(frame, p.x, p.y)) != arcSamples[i])
+                {
+                    invalidateArc();
+                    break;
+                }
+            }
+            if (arcValid)
+            {
+                return;
+            }
+        }
+
+        double start = 0;
+        double length = 0;
+        if (!detectTargetArc(frame, start, length))
+        {
+            arcDetected = false;
+            return;
+        }
+
+        // arc may still be animating after a hit: trust it when seen twice at the same place
+        const double tolerance = 2.0 / ringRadius;
+        arcValid = arcDetected && fabs(remainder(start - arcStart, twoPi)) < tolerance && fabs(length - arcLength) < tolerance;
+        arcDetected = true;
+        arcStart = start;
+        arcLength = length;
+        if (arcValid)
+        {
+            arcSamples.clear();
+            for (int i = 0; i < 16; ++i)
+            {
+                const Point p = arcSample(i);
+                arcSamples.push_back(palette.classOf(pixel(frame, p.x, p.y)));
+            }
+        }
+    }
+
+    // ball fully over the target, or over the middle half of an arc narrower than the ball
+    bool ballOnArc() const
+    {
+        if (arcLength <= 0)
+        {
+            return false;
+        }
+        const double margin = min((ball.width() / 2.0 + 2) / ringRadius, arcLength / 4);
+        const double d = wrapAngle(ballAngle() - arcStart);
+        return d >= margin && d <= arcLength - margin;
+    }
+
+    // target arc ahead of the ball along dir as distances like findTargetArc(). The start of the
+    // confirmed arc is where it actually is, before skip (or behind the ball) once the ball is in it
+    bool targetArcAhead(const GameFrame& frame, double from, int dir, double skip, double& start, double& end) const
+    {
+        if (!arcValid)
+        {
+            return findTargetArc(frame, from, dir, skip, start, end);
+        }
+        if (arcLength <= 0)
+        {
+            return false;
+        }
+
+        double s = dir > 0 ? wrapAngle(arcStart - from) : wrapAngle(from - (arcStart + arcLength));
+        double e = s + arcLength;
+        if (e > twoPi && e - twoPi > skip)
+        {
+            // ball inside the arc
+            s -= twoPi;
+            e -= twoPi;
+        }
+        start = s;
+        end = e;
+        return end > max(s, skip);
+    }
+
+    // classic decision: fire once the ball is over the target
+    void decideSurrounded(const GameFrame& frame)
+    {
+        Rect ballBox = ball;
+        expand(ballBox);
+        const auto t = Clock::now();
+        const bool surrounded = arcValid ? ballOnArc() : isBallSurrounded(frame, ballBox);
+        stats.record(Instrumentation::Surrounded, Clock::now() - t);
+        if (surrounded)
+        {
+            if (!hasFired)
+            {
+                // ball surrounded by non-field color: consider firing
+                hasFired = fire();
+            }
+        }
+        else
+        {
+            hasFired = false;
+        }
+    }
+
+    // schedule fire for when the ball is expected to reach the next target arc, false if there is no prediction
+    bool decidePredicted(const GameFrame& frame, Clock::time_point now)
+    {
+        const double v = trajectory.velocity();
+        if (!trajectory.ready() || fabs(v) < 0.1 || trackRadius < 1)
+        {
+            return false;
+        }
+
+        const int dir = v > 0 ? 1 : -1;
+        const double position = trajectory.predict(now);
+        if (hasFired)
+        {
+            // re-arm once the arc we fired at is gone (hit) or the ball left it
+            if (!palette.is(trackPixel(frame, fireArcMiddle), fieldClass) && dir * (position - fireArcEnd) <= 0)
+            {
+                return true;
+            }
+            hasFired = false;
+        }
+
+        const double ballRadius = (ball.width() / 2.0) / trackRadius;
+        const double skip = ballRadius + 2.0 / trackRadius;
+        double start = 0;
+        double end = 0;
+        if (!targetArcAhead(frame, trajectory.angle(), dir, skip, start, end))
+        {
+            fireScheduled = false;
+            return false;
+        }
+
+        // aim for the ball to be fully over the arc even if the fire goes out half a frame early
+        // (with the frame closest to the due time), or its middle if the arc is narrow.
+        // an unconfirmed arc starting right at the ball edge may already be under the ball: fire now
+        const double margin = ballRadius + fabs(v) * chrono::duration<double>(frameInterval).count() / 2;
+        fireAimed = arcValid || start > skip;
+        const double aim = !fireAimed
+            ? position
+            : trajectory.angle() + dir * (start + min(margin, (end - start) / 2));
+        const double seconds = dir * (aim - position) / fabs(v);
+        fireAim = aim;
+        fireArcMiddle = trajectory.angle() + dir * (start + end) / 2;
+        fireArcEnd = trajectory.angle() + dir * (end + ballRadius);
+        fireAt = now + chrono::duration_cast<Clock::duration>(chrono::duration<double>(seconds)) - lead;
+        fireScheduled = true;
+        fireIfDue(now);
+        return true;
+    }
+
+    // points inside the arc a fire aims at: the confirmed arc, else the one of a predicted fire
+    void watchArc()
+    {
+        watchCount = 0;
+        watchSince = frameTime;
+        watchPredicted = fireScheduled && fireAimed;
+        watchAim = fireAim;
+        watchLead = lead;
+        watchLate = frameTime - fireAt;
+        watchExpected = false;
+        if (arcValid && arcLength > 0)
+        {
+            for (int i = 0; i < 3; ++i)
+            {
+                watchAngles[watchCount++] = arcStart + arcLength * (i + 1) / 4;
+            }
+        }
+        else if (fireScheduled)
+        {
+            watchAngles[watchCount++] = fireArcMiddle;
+        }
+    }
+
+    // lead that would have landed the watched fire on its aim, ball at angle seen in the frame
+    // the key landed in (at most) and moving at v
+    Clock::duration idealLead(double seen, double v) const
+    {
+        // seconds the key landed after the ball reached the aim
+        const double landed = seen - v * chrono::duration<double>(frameInterval).count() / 2;
+        const double late = remainder(landed - watchAim, twoPi) / v;
+        const Clock::duration ideal = watchLead - watchLate + chrono::duration_cast<Clock::duration>(chrono::duration<double>(late));
+        return min(Clock::duration(chrono::seconds(1)), max(Clock::duration::zero(), ideal));
+    }
+
+    // a hit moves the arc away: the first frame with field at a watched point the ball doesn't cover.
+    // Without that for a second the fire missed (the game stops) or the arc wasn't the target
+    void observeFire(const GameFrame& frame, bool found)
+    {
+        if (watchCount == 0)
+        {
+            return;
+        }
+
+        const Clock::duration latency = frameTime - watchSince;
+        const double v = trajectory.velocity();
+        const bool moving = found && trajectory.ready() && fabs(v) >= 0.1;
+        if (latency > chrono::seconds(1))
+        {
+            watchCount = 0;
+            if (!watchPredicted)
+            {
+                return;
+            }
+            if (watchExpected)
+            {
+                calibrator.addLead(idealLead(watchBall, v));
+            }
+            else
+            {
+                calibrator.missed(configuredLead);
+            }
+            applyCalibration();
+            cerr << "[" << frameCount << "] miss: lead=" << fixedPoint(chrono::duration<double, milli>(lead).count(), 1) << " ms" << endl;
+            return;
+        }
+
+        Rect ballBox = ball;
+        expand(ballBox);
+        expand(ballBox);
+        for (int i = 0; i < watchCount; ++i)
+        {
+            const int x = (int)lround(trackX() + trackRadius * cos(watchAngles[i]));
+            const int y = (int)lround(trackY() + trackRadius * sin(watchAngles[i]));
+            if (!ballBox.contains(x, y) && palette.is(pixel(frame, x, y), fieldClass))
+            {
+                watchCount = 0;
+                calibrator.addLatency(latency);
+                if (watchPredicted && moving)
+                {
+                    calibrator.addLead(idealLead(atan2(ballY - trackY(), ballX - trackX()), v));
+                }
+                applyCalibration();
+                cerr << "[" << frameCount << "] hit after " << fixedPoint(chrono::duration<double, milli>(latency).count(), 1)
+                    << " ms: lead=" << fixedPoint(chrono::duration<double, milli>(lead).count(), 1)
+                    << " ms, deadzone=" << fixedPoint(chrono::duration<double, milli>(deadzone).count(), 1) << " ms" << endl;
+                return;
+            }
+        }
+
+        // where the ball was when the hit should have shown, in case it doesn't
+        if (!watchExpected && moving && calibrator.ready() && latency >= calibrator.calibration().latency)
+        {
+            watchExpected = true;
+            watchBall = atan2(ballY - trackY(), ballX - trackX());
+        }
+    }
+
+    void applyCalibration()
+    {
+        if (calibrating && calibrator.ready())
+        {
+            deadzone = calibrator.deadzone(frameInterval);
+        }
+        if (calibrating && calibrator.leadReady())
+        {
+            lead = calibrator.lead();
+        }
+    }
+
+    // fire a scheduled shot now if waiting for the next frame would be later than closer
+    void fireIfDue(Clock::time_point now)
+    {
+        if (fireScheduled && fireAt <= now + frameInterval / 2)
+        {
+            if (fire())
+            {
+                fireScheduled = false;
+                hasFired = true;
+            }
+        }
+    }
+
+    void capture(GameFrame& frame)
+    {
+        frameStart = Clock::now();
+        frame.next();
+        view = frame.view();
+        stats.record(Instrumentation::Capture, Clock::now() - frameStart);
+        stats.frame();
+
+        const Clock::time_point t = frame.timestamp();
+        if (frameCount == 0)
+        {
+            // frame clock may have any epoch (replay)
+            lastFireTime = t;
+            lastBall = t;
+            lastBallMove = t;
+        }
+        else
+        {
+            frameInterval = (frameInterval * 7 + (t - frameTime)) / 8;
+        }
+        frameTime = t;
+    }
+
+    void snapshot(const GameFrame& frame, const char *event)
+    {
+        if (snapshots != nullptr)
+        {
+            snapshots->submit(frame, view, field, snapshotPrefix + event + "-" + to_string(frameCount) + ".png");
+        }
+    }
+
+    // simulate keypress
+    bool fire()
+    {
+        if (frameCount - lastFire >= deadzoneFrames && frameTime - lastFireTime >= deadzone)
+        {
+            const auto t = Clock::now();
+            controls.fire();
+            const auto fired = Clock::now();
+            stats.record(Instrumentation::Fire, fired - t);
+            stats.record(Instrumentation::FrameToFire, fired - frameStart);
+            cerr << "[" << frameCount << "] (ign. " << ignoredCount << ") FIRE!" << endl;
+            ignoredCount = 0;
+            lastFire = frameCount;
+            lastFireTime = frameTime;
+            if (calibrating)
+            {
+                watchArc();
+            }
+            invalidateArc();
+            return true;
+        }
+        else
+        {
+            ++ignoredCount;
+            return false;
+        }
+    }
+
+
+public:
+
+    Game(GameControls& controls, int width, int height, int deadzoneFrames) :
+        controls(controls),
+        width(width),
+        height(height),
+        screen(0, 0, width, height),
+        zone(screen),
+        ball(0, 0, 0, 0),
+        ballX(0),
+        ballY(0),
+        motion(),
+        field(0, 0, 0, 0),
+        maskY0(0),
+        fieldClosed(false),
+        frameCount(0),
+        lastFire(0),
+        frameTime(),
+        lastFireTime(),
+        lastBall(),
+        lastBallMove(),
+        deadzoneFrames(deadzoneFrames),
+        deadzone(0),
+        stallTimeout(chrono::seconds(2)),
+        lostTimeout(chrono::seconds(2)),
+        ignoredCount(0),
+        hasFired(false),
+        view(),
+        palette({fieldColor, ballColor}, 0),
+        predictive(false),
+        lead(0),
+        configuredLead(0),
+        trackRadius(0),
+        frameInterval(chrono::milliseconds(1)),
+        fireScheduled(false),
+        fireAim(0),
+        fireArcMiddle(0),
+        fireArcEnd(0),
+        calibrating(false),
+        watchCount(0),
+        watchPredicted(false),
+        watchAim(0),
+        watchLead(0),
+        watchLate(0),
+        watchExpected(false),
+        watchBall(0),
+        fireAimed(false),
+        frameStart(Clock::now()),
+        pool(nullptr),
+        snapshots(nullptr),
+        ringX(0),
+        ringY(0),
+        ringRadius(0),
+        ringStride(0),
+        ringBounds(),
+        arcValid(false),
+        arcDetected(false),
+        arcStart(0),
+        arcLength(0),
+        lastHash(0),
+        hashedBall(),
+        hashValid(false),
+        lastFound(false)
+    {
+    }
+
+    // fire on the predicted arrival of the ball on the target instead of when it is already there
+    void setPrediction(bool enabled, Clock::duration latency)
+    {
+        predictive = enabled;
+        lead = latency;
+        configuredLead = latency;
+    }
+
+    // learn lead and dead zone during play from the latency of hits, starting from an earlier estimate
+    // (until there is one the configured values apply)
+    void setCalibration(bool enabled, const Calibration& start)
+    {
+        calibrating = enabled;
+        calibrator.reset(start);
+    }
+
+    const LatencyCalibrator& calibration() const
+    {
+        return calibrator;
+    }
+
+    // match field and ball colors off by up to tolerance per channel (anti-aliasing, scaling,
+    // color management), 0 for exact matches
+    void setTolerance(int tolerance)
+    {
+        palette = Palette({fieldColor, ballColor}, tolerance);
+    }
+
+    // minimum time between fires (in addition to the dead-zone in frames)
+    void setDeadzone(Clock::duration duration)
+    {
+        deadzone = duration;
+    }
+
+    // stop playing when the ball didn't move (stalled) or wasn't seen (lost) for this long
+    void setTimeouts(Clock::duration stalled, Clock::duration lost)
+    {
+        stallTimeout = stalled;
+        lostTimeout = lost;
+    }
+
+    // share zone scans for a lost or unknown ball with the threads of pool, nullptr for serial
+    void setWorkerPool(WorkerPool *workers)
+    {
+        pool = workers;
+    }
+
+    // save the playing field whenever firing and when the game stops to prefix<event>-<frame>.png
+    void setSnapshots(SnapshotWriter *writer, const string& prefix)
+    {
+        snapshots = writer;
+        snapshotPrefix = prefix;
+    }
+
+    ~Game()
+    {
+    }
+
+    // screen area the next step looks at
+    Rect region() const
+    {
+        return haveField() ? field : zone;
+    }
+
+    // look for the field only in this part of the screen (one of several games)
+    void setZone(const Rect& r)
+    {
+        zone = r;
+        zone.clip(screen);
+    }
+
+    // every ball on the 4 pixel grid of the screen (see coldScanForBall()), in scan order
+    vector<Rect> findBalls(GameFrame& frame)
+    {
+        frame.next();
+        view = frame.view();
+        vector<Rect> balls;
+        for (int y = 0; y < height; y += 4)
+        {
+            for (int x = 0; x < width; x += 4)
+            {
+                bool known = false;
+                for (const Rect& r : balls)
+                {
+                    known = known || (x >= r.x0 && x <= r.x1 && y >= r.y0 && y <= r.y1);
+                }
+
+                Blob b;
+                if (!known && palette.is(pixel(frame, x, y), ballClass) && checkForBall(frame, x, y, b))
+                {
+                    balls.push_back(b.bounds);
+                }
+            }
+        }
+        return balls;
+    }
+
+    Instrumentation& instrumentation()
+    {
+        return stats;
+    }
+
+    bool step(GameFrame& frame)
+    {
+        bool hadField = haveField();
+
+        bool keepPlaying; 
+        if (!hadField)
+        {
+            capture(frame);
+
+            const Rect lastField = field;
+            const auto t = Clock::now();
+            keepPlaying = expandField(frame);
+            stats.record(Instrumentation::FindBall, Clock::now() - t);
+            if (keepPlaying)
+            {
+                if (lastField == field && field == ball)
+                {
+                    // initial space keypress to start game (if ball doesn't move)
+                    controls.focus(ball.centerX(), ball.centerY());
+                    controls.fire();
+                    expand(field);
+                    cerr << "[" << frameCount << "] game started" << endl;
+                }
+                else if (haveField())
+                {
+                    // finally add safety margin to the playing field
+                    calibrateRing();
+                    addFieldSafetyMargin();
+                    maskField();
+                    controls.move(field.x1, field.y1);  // move away to not block view
+                    cerr << "[" << frameCount << "] game field: " << field << endl;
+
+                    // from now on only grab the playing field
+                    frame.setRegion(field);
+                }
+            }
+        }
+        else
+        {
+            capture(frame);
+            applyCalibration();
+
+            const auto now = frameTime;
+            const auto t = Clock::now();
+            if (predictive)
+            {
+                // scheduled from an earlier frame, even if the ball isn't visible in this one
+                fireIfDue(now);
+            }
+
+            // nothing moved: the last decision stands, and the trajectory gets no stale sample
+            const bool repeated = unchanged(frame);
+            const bool found = repeated ? lastFound : findBall(frame, field);
+            if (repeated)
+            {
+                stats.duplicate();
+            }
+            else
+            {
+                stats.record(Instrumentation::FindBall, Clock::now() - t);
+                rehash();
+                observeFire(frame, found);
+            }
+            lastFound = found;
+            if (found && !repeated)
+            {
+                updateTargetArc(frame);
+                if (predictive)
+                {
+                    trackBall(now);
+                }
+
+                if (!predictive || !decidePredicted(frame, now))
+                {
+                    decideSurrounded(frame);
+                }
+            }
+            if (found)
+            {
+
+                keepPlaying = now - lastBallMove < stallTimeout;
+                if (!keepPlaying)
+                {
+                    cerr << "[" << frameCount << "] game stopped" << endl;
+                    snapshot(frame, "stopped");
+                }
+            }
+            else
+            {
+                keepPlaying = now - lastBall < lostTimeout;
+            }
+
+            if (lastFire == frameCount)
+            {
+                snapshot(frame, "fire");
+            }
+        }
+
+        ++frameCount;
+
+        return keepPlaying;
+    }
+};
+
+
+// one game's part of a capture shared by several games: the zone of the game, grabbed by
+// the supervisor (next() does nothing) as part of the union of the regions all games ask for
+class SharedFrame : public GameFrame
+{
+    const GameFrame& frame;
+    const Rect zone;
+    Rect wanted;
+
+public:
+
+    SharedFrame(const GameFrame& frame, const Rect& zone) :
+        frame(frame),
+        zone(zone),
+        wanted(zone)
+    {
+    }
+
+    const Rect& region() const
+    {
+        return wanted;
+    }
+
+    void next()
+    {
+    }
+
+    void setRegion(const Rect& r)
+    {
+        wanted = r.width() > 0 && r.height() > 0 ? r : zone;
+        wanted.clip(zone);
+    }
+
+    Pixel getPixel(int x, int y) const
+    {
+        return zone.contains(x, y) ? frame.getPixel(x, y) : Pixel();
+    }
+
+    PixelView view() const
+    {
+        const PixelView v = frame.view();
+        if (!v.valid())
+        {
+            return v;
+        }
+
+        Rect b = v.bounds;
+        b.clip(zone);
+        if (b.width() == 0 || b.height() == 0)
+        {
+            return PixelView(v.data, v.stride, Rect(v.bounds.x0, v.bounds.y0, v.bounds.x0, v.bounds.y0));
+        }
+        return PixelView(reinterpret_cast<const uint8_t*>(v.at(b.x0, b.y0)), v.stride, b);
+    }
+
+    Clock::time_point timestamp() const
+    {
+        return frame.timestamp();
+    }
+
+    void savePng(const string path) const
+    {
+        frame.savePng(path);
+    }
+
+    bool repeated() const
+    {
+        return frame.repeated();
+    }
+};
+
+// controls of one of several games: key events go to the focused window, so fire() first
+// focuses the game's window (at the last pointer position of the game) if another game had it
+class RoutedControls : public GameControls
+{
+    GameControls& controls;
+    RoutedControls *&focused;   // shared by all games
+    int x;
+    int y;
+
+public:
+
+    RoutedControls(GameControls& controls, RoutedControls *&focused, int x, int y) :
+        controls(controls),
+        focused(focused),
+        x(x),
+        y(y)
+    {
+    }
+
+    void fire()
+    {
+        if (focused != this)
+        {
+            controls.focus(x, y);
+            focused = this;
+        }
+        controls.fire();
+    }
+
+    void move(int x, int y)
+    {
+        this->x = x;
+        this->y = y;
+        controls.move(x, y);
+    }
+
+    void click(int x, int y)
+    {
+        this->x = x;
+        this->y = y;
+        controls.click(x, y);
+        focused = this;
+    }
+
+    void focus(int x, int y)
+    {
+        this->x = x;
+        this->y = y;
+        controls.focus(x, y);
+        focused = this;
+    }
+};
+
+// several games on one screen (browser windows side by side): one Game per ball found,
+// each searching its field in its own zone of a single capture of all of them
+class GameSupervisor
+{
+    GameFrame& frame;
+    RoutedControls *focused;
+    vector<unique_ptr<SharedFrame>> frames;
+    vector<unique_ptr<RoutedControls>> routes;
+    vector<unique_ptr<Game>> games;
+    vector<bool> playing;
+    Rect unionRegion;
+
+    void updateRegion()
+    {
+        unionRegion = Rect();
+        for (size_t i = 0; i < games.size(); ++i)
+        {
+            if (!playing[i])
+            {
+                continue;
+            }
+            if (unionRegion.width() == 0)
+            {
+                unionRegion = frames[i]->region();
+            }
+            else
+            {
+                unionRegion.add(frames[i]->region());
+            }
+        }
+        frame.setRegion(unionRegion);
+    }
+
+public:
+
+    // setup(game, index) configures each game (and the scout finding the balls, index -1)
+    GameSupervisor(GameFrame& frame, GameControls& controls, int width, int height, int count, function<void(Game&, int)> setup) :
+        frame(frame),
+        focused(nullptr)
+    {
+        const Rect screen(0, 0, width, height);
+        NullControls none;
+        Game scout(none, width, height, 1);
+        setup(scout, -1);
+        frame.setRegion(screen);
+        vector<Rect> balls = scout.findBalls(frame);
+        if ((int)balls.size() > count)
+        {
+            balls.resize(count);
+        }
+        if ((int)balls.size() < count)
+        {
+            cerr << "warning: found " << balls.size() << " of " << count << " games" << endl;
+        }
+        if (balls.empty())
+        {
+            // a single game reports the missing ball
+            balls.push_back(Rect(width / 2, height / 2, width / 2, height / 2));
+        }
+
+        // split the screen between each two balls, across the axis they are further apart on
+        for (size_t i = 0; i < balls.size(); ++i)
+        {
+            const double cx = (balls[i].x0 + balls[i].x1) / 2.0;
+            const double cy = (balls[i].y0 + balls[i].y1) / 2.0;
+            Rect zone = screen;
+            for (size_t j = 0; j < balls.size(); ++j)
+            {
+                const double dx = (balls[j].x0 + balls[j].x1) / 2.0 - cx;
+                const double dy = (balls[j].y0 + balls[j].y1) / 2.0 - cy;
+                if (j == i)
+                {
+                    continue;
+                }
+                if (fabs(dx) >= fabs(dy))
+                {
+                    const int middle = (int)lround(cx + dx / 2);
+                    zone.x0 = dx > 0 ? zone.x0 : max(zone.x0, middle);
+                    zone.x1 = dx > 0 ? min(zone.x1, middle) : zone.x1;
+                }
+                else
+                {
+                    const int middle = (int)lround(cy + dy / 2);
+                    zone.y0 = dy > 0 ? zone.y0 : max(zone.y0, middle);
+                    zone.y1 = dy > 0 ? min(zone.y1, middle) : zone.y1;
+                }
+            }
+
+            frames.emplace_back(new SharedFrame(frame, zone));
+            routes.emplace_back(new RoutedControls(controls, focused, zone.centerX(), zone.centerY()));
+            games.emplace_back(new Game(*routes.back(), width, height, 1));
+            games.back()->setZone(zone);
+            setup(*games.back(), (int)i);
+            playing.push_back(true);
+            cerr << "game " << i << ": zone " << zone << endl;
+        }
+        updateRegion();
+    }
+
+    size_t size() const
+    {
+        return games.size();
+    }
+
+    Game& game(size_t i)
+    {
+        return *games[i];
+    }
+
+    // union of the regions of the games still playing
+    const Rect& region() const
+    {
+        return unionRegion;
+    }
+
+    void dumpPeriodically(ostream& os, chrono::seconds interval)
+    {
+        for (auto& game : games)
+        {
+            game->instrumentation().dumpPeriodically(os, interval);
+        }
+    }
+
+    void dump(ostream& os)
+    {
+        for (size_t i = 0; i < games.size(); ++i)
+        {
+            os << "game " << i << ":" << endl;
+            games[i]->instrumentation().dump(os);
+        }
+    }
+
+    // grab once, step every game still playing on it, false once all stopped
+    bool step()
+    {
+        frame.next();
+        bool any = false;
+        for (size_t i = 0; i < games.size(); ++i)
+        {
+            if (playing[i])
+            {
+                playing[i] = games[i]->step(*frames[i]);
+                if (!playing[i])
+                {
+                    cerr << "game " << i << " stopped" << endl;
+                }
+                any = any || playing[i];
+            }
+        }
+        updateRegion();
+        return any;
+    }
+};
+
+
+// channel layouts of the common visuals, decoding a pixel value to BGRx (as Pixel::c)
+struct Rgb888
+{
+    static uint32_t decode(uint32_t v)
+    {
+        return v & 0xffffff;
+    }
+};
+
+struct Rgb565
+{
+    static uint32_t decode(uint32_t v)
+    {
+        const uint32_t r = (v >> 11) & 0x1f;
+        const uint32_t g = (v >> 5) & 0x3f;
+        const uint32_t b = v & 0x1f;
+        return ((r << 3 | r >> 2) << 16) | ((g << 2 | g >> 4) << 8) | (b << 3 | b >> 2);
+    }
+};
+
+// 30-bit deep color, the low 2 bits per channel are dropped
+struct Rgb101010
+{
+    static uint32_t decode(uint32_t v)
+    {
+        return (((v >> 22) & 0xff) << 16) | (((v >> 12) & 0xff) << 8) | ((v >> 2) & 0xff);
+    }
+};
+
+// pixels of bytes each in image byte order, fully inlined per layout
+template <int bytes, bool msbFirst, typename Channels>
+struct PixelFormat
+{
+    static uint32_t read(const uint8_t *p)
+    {
+        uint32_t v = 0;
+        for (int i = 0; i < bytes; ++i)
+        {
+            v |= (uint32_t)p[i] << (8 * (msbFirst ? bytes - 1 - i : i));
+        }
+        return Channels::decode(v);
+    }
+
+    static void convertRow(const uint8_t *src, uint32_t *dst, int n)
+    {
+        for (int i = 0; i < n; ++i, src += bytes)
+        {
+            dst[i] = read(src);
+        }
+    }
+};
+
+// convert n pixels of a row in some visual's layout to BGRx
+typedef void (*ConvertRowKernel)(const uint8_t *src, uint32_t *dst, int n);
+
+// the game reads 32 bit little endian BGRx directly
+static bool nativeFormat(const XImage *image)
+{
+    return image->bits_per_pixel == 32
+        && image->byte_order == LSBFirst
+        && image->red_mask == 0xff0000
+        && image->green_mask == 0xff00
+        && image->blue_mask == 0xff;
+}
+
+// converter for other layouts, nullptr if there is none (pixels are then read one by one through Xlib)
+static ConvertRowKernel selectConvertRowKernel(const XImage *image)
+{
+    const bool msb = image->byte_order == MSBFirst;
+    const unsigned long r = image->red_mask;
+    const unsigned long g = image->green_mask;
+    const unsigned long b = image->blue_mask;
+    if (r == 0xff0000 && g == 0xff00 && b == 0xff)
+    {
+        switch (image->bits_per_pixel)
+        {
+        case 32:
+            return msb ? PixelFormat<4, true, Rgb888>::convertRow : PixelFormat<4, false, Rgb888>::convertRow;
+        case 24:
+            return msb ? PixelFormat<3, true, Rgb888>::convertRow : PixelFormat<3, false, Rgb888>::convertRow;
+        }
+    }
+    else if (r == 0xf800 && g == 0x7e0 && b == 0x1f && image->bits_per_pixel == 16)
+    {
+        return msb ? PixelFormat<2, true, Rgb565>::convertRow : PixelFormat<2, false, Rgb565>::convertRow;
+    }
+    else if (r == 0x3ff00000 && g == 0xffc00 && b == 0x3ff && image->bits_per_pixel == 32)
+    {
+        return msb ? PixelFormat<4, true, Rgb101010>::convertRow : PixelFormat<4, false, Rgb101010>::convertRow;
+    }
+    return nullptr;
+}
+
+
+// XImage of region in a MIT-SHM segment.
+// Visuals other than BGRx are converted by decode() after each grab, so the game's view works on all
+class ShmImage
+{
+    Display *display;
+    ConvertRowKernel convert;       // nullptr if native (or without converter)
+    vector<uint32_t> converted;     // decoded pixels of a non-native image
+    static inline bool reported = false;
+
+    void report() const
+    {
+        if (reported)
+        {
+            return;
+        }
+        reported = true;
+        if (convert != nullptr)
+        {
+            cerr << "capture: converting " << image->bits_per_pixel << " bpp (depth " << image->depth << ", "
+                << (image->byte_order == MSBFirst ? "msb" : "lsb") << " first) to BGRx" << endl;
+        }
+        else if (!nativeFormat(image))
+        {
+            cerr << "warning: unsupported pixel format (" << image->bits_per_pixel << " bpp, depth " << image->depth
+                << "), reading pixels one by one" << endl;
+        }
+    }
+
+public:
+
+    XImage *image;
+    XShmSegmentInfo shminfo;
+    const Rect region;
+    Clock::time_point timestamp;    // of the last grab into this image
+    static inline bool prefault = false;    // touch all pages on creation, not on the first grabs
+
+    ShmImage(Display *display, Visual *visual, int depth, const Rect& region) :
+        display(display),
+        convert(nullptr),
+        image(nullptr),
+        region(region)
+    {
+        image = XShmCreateImage(display, visual, depth, ZPixmap, NULL, &shminfo, region.width(), region.height());
+        if (!nativeFormat(image))
+        {
+            convert = selectConvertRowKernel(image);
+        }
+        if (convert != nullptr)
+        {
+            converted.resize((size_t)image->width * image->height);
+        }
+        report();
+
+        shminfo.shmid = shmget(IPC_PRIVATE, image->bytes_per_line * image->height, IPC_CREAT|0777);
+        shminfo.shmaddr = image->data = (char*) shmat(shminfo.shmid, 0, 0);
+        shminfo.readOnly = False;
+        if (prefault)
+        {
+            memset(image->data, 0, (size_t)image->bytes_per_line * image->height);
+        }
+
+        auto stat = XShmAttach(display, &shminfo);
+        if (!stat)
+        {
+            cerr << "error: XShmAttach() failed" << endl;
+        }
+    }
+
+    ~ShmImage()
+    {
+        XShmDetach(display, &shminfo);
+        XSync(display, False);  // server must be done with the segment before we drop it
+        XDestroyImage(image);
+        shmdt(shminfo.shmaddr);
+        shmctl(shminfo.shmid, IPC_RMID, NULL);
+    }
+
+
+    // call after each grab into the image
+    void decode()
+    {
+        if (convert == nullptr)
+        {
+            return;
+        }
+        for (int y = 0; y < image->height; ++y)
+        {
+            convert(reinterpret_cast<const uint8_t*>(image->data) + (size_t)y * image->bytes_per_line,
+                converted.data() + (size_t)y * image->width, image->width);
+        }
+    }
+
+
+    Pixel getPixel(int x, int y) const
+    {
+        if (!region.contains(x, y))
+        {
+            return Pixel();
+        }
+        if (convert != nullptr)
+        {
+            return Pixel(converted[(size_t)(y - region.y0) * image->width + (x - region.x0)]);
+        }
+        return Pixel(image->f.get_pixel(image, x - region.x0, y - region.y0));
+    }
+
+
+    PixelView view() const
+    {
+        if (convert != nullptr)
+        {
+            return PixelView(reinterpret_cast<const uint8_t*>(converted.data()), image->width * (int)sizeof(uint32_t), region);
+        }
+        if (!nativeFormat(image))
+        {
+            return PixelView();
+        }
+        return PixelView(reinterpret_cast<const uint8_t*>(image->data), image->bytes_per_line, region);
+    }
+
+
+    void savePng(const string path) const
+    {
+        const PixelView v = view();
+        ::savePng(path, image->width, image->height, [&](int y, uint32_t *row)
+        {
+            if (v.valid())
+            {
+                memcpy(row, v.at(region.x0, region.y0 + y), image->width * sizeof(uint32_t));
+            }
+            else
+            {
+                for (int x = 0; x < image->width; ++x)
+                {
+                    row[x] = image->f.get_pixel(image, x, y);
+                }
+            }
+        });
+    }
+};
+
+
+// clip r to screen, empty means everything
+static Rect captureRegion(const Rect& r, const Rect& screen)
+{
+    Rect clipped = r;
+    clipped.clip(screen);
+    if (clipped.width() == 0 || clipped.height() == 0)
+    {
+        clipped = screen;
+    }
+    return clipped;
+}
+
+
+class XImageFrame : public GameFrame
+{
+    Display *display;
+    Window root;
+    Visual *visual;
+    int depth;
+    Rect screen;
+
+    unique_ptr<ShmImage> image;
+
+public:
+
+    XImageFrame(Display *display, Window root) :
+        display(display),
+        root(root)
+    {
+        auto shm_ext = XInitExtension(display, "MIT-SHM");
+        if (!shm_ext->extension)
+        {
+            cerr << "error: MIT-SHM extension not available" << endl;
+        }
+
+        XWindowAttributes root_attr;
+        XGetWindowAttributes(display, root, &root_attr);
+
+        visual = DefaultVisualOfScreen(root_attr.screen);
+        depth = root_attr.depth;
+        screen = Rect(0, 0, root_attr.width, root_attr.height);
+
+        image.reset(new ShmImage(display, visual, depth, screen));
+
+        //cerr << "ext=" << shm_ext->extension << ", shmid=" << image->shminfo.shmid << ", shmaddr=" << (uintptr_t)image->shminfo.shmaddr << ", vis=" << (uintptr_t)root_attr.visual << ", depth=" << root_attr.depth << ", width=" << root_attr.width << ", height=" << root_attr.height << endl;
+    }
+
+
+    void next()
+    {
+        image->timestamp = Clock::now();
+        auto success = XShmGetImage(display, root, image->image, image->region.x0, image->region.y0, AllPlanes);
+        if (!success)
+        {
+            cerr << "error: XShmGetImage() failed" << endl;
+        }
+        image->decode();
+
+        //cerr << "image: data=" << (uintptr_t)image->image->data
+        //    << ", byte_order=" << image->image->byte_order
+        //    << ", depth=" << image->image->depth
+        //    << ", bytes_per_line=" << image->image->bytes_per_line
+        //    << ", bits_per_pixel=" << image->image->bits_per_pixel
+        //    << endl;
+    }
+
+
+    void setRegion(const Rect& r)
+    {
+        const Rect clipped = captureRegion(r, screen);
+        if (clipped != image->region)
+        {
+            // shm segment is sized to the region, so re-create it
+            image.reset();
+            image.reset(new ShmImage(display, visual, depth, clipped));
+        }
+    }
+
+
+    Pixel getPixel(int x, int y) const
+    {
+        return image->getPixel(x, y);
+    }
+
+
+    PixelView view() const
+    {
+        return image->view();
+    }
+
+
+    Clock::time_point timestamp() const
+    {
+        return image->timestamp;
+    }
+
+
+    void savePng(const string path) const
+    {
+        image->savePng(path);
+    }
+};
+
+
+// window at or below window that carries the property (WM_STATE marks client windows), None if none
+static Window windowWithProperty(Display *display, Window window, Atom property)
+{
+    int count = 0;
+    Atom *properties = XListProperties(display, window, &count);
+    bool found = false;
+    for (int i = 0; i < count && !found; ++i)
+    {
+        found = properties[i] == property;
+    }
+    if (properties != nullptr)
+    {
+        XFree(properties);
+    }
+    if (found)
+    {
+        return window;
+    }
+
+    Window rootReturn;
+    Window parent;
+    Window *children = nullptr;
+    unsigned n = 0;
+    Window client = None;
+    if (XQueryTree(display, window, &rootReturn, &parent, &children, &n))
+    {
+        for (unsigned i = 0; i < n && client == None; ++i)
+        {
+            client = windowWithProperty(display, children[i], property);
+        }
+        if (children != nullptr)
+        {
+            XFree(children);
+        }
+    }
+    return client;
+}
+
+// client window inside a window manager frame, window itself if there is none
+static Window clientWindow(Display *display, Window window)
+{
+    const Atom wmState = XInternAtom(display, "WM_STATE", True);
+    const Window client = wmState != None ? windowWithProperty(display, window, wmState) : None;
+    return client != None ? client : window;
+}
+
+// first viewable window below parent with name containing part
+static Window windowByName(Display *display, Window parent, const string& part)
+{
+    Window rootReturn;
+    Window parentReturn;
+    Window *children = nullptr;
+    unsigned count = 0;
+    if (!XQueryTree(display, parent, &rootReturn, &parentReturn, &children, &count))
+    {
+        return None;
+    }
+
+    Window found = None;
+    for (unsigned i = count; i-- > 0 && found == None; )
+    {
+        char *name = nullptr;
+        XWindowAttributes attributes;
+        if (XFetchName(display, children[i], &name) && name != nullptr)
+        {
+            if (string(name).find(part) != string::npos
+                && XGetWindowAttributes(display, children[i], &attributes)
+                && attributes.map_state == IsViewable)
+            {
+                found = children[i];
+            }
+            XFree(name);
+        }
+        if (found == None)
+        {
+            found = windowByName(display, children[i], part);
+        }
+    }
+    if (children != nullptr)
+    {
+        XFree(children);
+    }
+    return found;
+}
+
+// window by id (decimal or 0x hex), by (part of its) name or the one under the pointer
+static Window findWindow(Display *display, Window root, const string& spec)
+{
+    if (spec == "pointer")
+    {
+        Window rootReturn;
+        Window child = None;
+        int dummy;
+        unsigned udummy;
+        XQueryPointer(display, root, &rootReturn, &child, &dummy, &dummy, &dummy, &dummy, &udummy);
+        return child != None ? clientWindow(display, child) : None;
+    }
+
+    char *end = nullptr;
+    const unsigned long id = strtoul(spec.c_str(), &end, 0);
+    if (end != spec.c_str() && *end == '\0')
+    {
+        return (Window) id;
+    }
+
+    return windowByName(display, root, spec);
+}
+
+
+// contents of a single window, even while occluded: the window is redirected off-screen
+// (XComposite) and grabbed from its named pixmap. Coordinates are relative to the window.
+class WindowFrame : public GameFrame
+{
+    Display *display;
+    Window window;
+    Visual *visual;
+    int depth;
+    Rect screen;                    // window size when the pixmap was named
+    Rect wanted;                    // requested region, empty for the whole window
+    Pixmap pixmap;
+
+    unique_ptr<ShmImage> image;
+
+    // the named pixmap is replaced whenever the window is resized
+    void namePixmap()
+    {
+        if (pixmap != None)
+        {
+            XFreePixmap(display, pixmap);
+        }
+        pixmap = XCompositeNameWindowPixmap(display, window);
+    }
+
+    // grabs must stay inside the pixmap, XShmGetImage() beyond its size is a fatal BadMatch
+    void clipImage()
+    {
+        const Rect clipped = captureRegion(wanted, screen);
+        if (clipped != image->region)
+        {
+            image.reset();
+            image.reset(new ShmImage(display, visual, depth, clipped));
+        }
+    }
+
+public:
+
+    static bool available(Display *display)
+    {
+        int eventBase;
+        int errorBase;
+        int major = 0;
+        int minor = 2;
+        return XCompositeQueryExtension(display, &eventBase, &errorBase)
+            && XCompositeQueryVersion(display, &major, &minor)
+            && (major > 0 || minor >= 2);
+    }
+
+    WindowFrame(Display *display, Window window) :
+        display(display),
+        window(window),
+        wanted(),
+        pixmap(None)
+    {
+        XWindowAttributes attributes;
+        XGetWindowAttributes(display, window, &attributes);
+        visual = attributes.visual;
+        depth = attributes.depth;
+        screen = Rect(0, 0, attributes.width, attributes.height);
+
+        XCompositeRedirectWindow(display, window, CompositeRedirectAutomatic);
+        XSelectInput(display, window, StructureNotifyMask);
+        namePixmap();
+
+        image.reset(new ShmImage(display, visual, depth, screen));
+    }
+
+    ~WindowFrame()
+    {
+        image.reset();
+        XFreePixmap(display, pixmap);
+        XCompositeUnredirectWindow(display, window, CompositeRedirectAutomatic);
+        XSync(display, False);
+    }
+
+    const Rect& bounds() const
+    {
+        return screen;
+    }
+
+    void next()
+    {
+        XEvent event;
+        Rect size = screen;
+        while (XCheckTypedWindowEvent(display, window, ConfigureNotify, &event))
+        {
+            size = Rect(0, 0, event.xconfigure.width, event.xconfigure.height);
+        }
+        if (size != screen)
+        {
+            // game coordinates stay, the region is clipped to what is left of a smaller window
+            screen = size;
+            namePixmap();
+            clipImage();
+        }
+
+        image->timestamp = Clock::now();
+        auto success = XShmGetImage(display, pixmap, image->image, image->region.x0, image->region.y0, AllPlanes);
+        if (!success)
+        {
+            cerr << "error: XShmGetImage() of window failed" << endl;
+        }
+        image->decode();
+    }
+
+    void setRegion(const Rect& r)
+    {
+        wanted = r;
+        clipImage();
+    }
+
+    Pixel getPixel(int x, int y) const
+    {
+        return image->getPixel(x, y);
+    }
+
+    PixelView view() const
+    {
+        return image->view();
+    }
+
+    Clock::time_point timestamp() const
+    {
+        return image->timestamp;
+    }
+
+    void savePng(const string path) const
+    {
+        image->savePng(path);
+    }
+};
+
+
+class XGameControls : public GameControls
+{
+    Display *display;
+    Window root;
+    bool sync;      // wait for the server to process fire()
+
+public:
+
+    XGameControls(Display *display, Window root, bool sync = false) :
+        display(display),
+        root(root),
+        sync(sync)
+    {
+    }
+
+    void fire()
+    {
+        auto keycode = XKeysymToKeycode(display, XK_space);
+        XTestFakeKeyEvent(display, keycode, True, 0);
+        //usleep(500);
+        XTestFakeKeyEvent(display, keycode, False, 0);
+        if (sync)
+        {
+            XSync(display, False);
+        }
+        else
+        {
+            XFlush(display);
+        }
+    }
+
+    void focus(int x, int y)
+    {
+        XWarpPointer(display, None, root, 0, 0, 0, 0, x, y);
+
+        Window window;
+        Window child;
+        int dummy;
+        unsigned udummy;
+        XQueryPointer(display, root, &window, &child, &dummy, &dummy, &dummy, &dummy, &udummy);
+
+        if (window)
+        {
+            XSetInputFocus(display, child, RevertToNone, CurrentTime);
+        }
+    }
+
+    void move(int x, int y)
+    {
+        XWarpPointer(display, None, root, 0, 0, 0, 0, x, y);
+    }
+
+    void click(int x, int y)
+    {
+        clickButton(x, y, Button1);
+    }
+
+    void clickButton(int x, int y, int button)
+    {
+        XWarpPointer(display, None, root, 0, 0, 0, 0, x, y);
+
+        XEvent event;
+        memset(&event, 0, sizeof(event));
+
+        event.type = ButtonPress;
+        event.xbutton.button = button;
+        event.xbutton.same_screen = True;
+
+        XQueryPointer(display, root, &event.xbutton.root, &event.xbutton.window, &event.xbutton.x_root, &event.xbutton.y_root, &event.xbutton.x, &event.xbutton.y, &event.xbutton.state);
+
+        event.xbutton.subwindow = event.xbutton.window;
+        while(event.xbutton.subwindow)
+        {
+            event.xbutton.window = event.xbutton.subwindow;
+
+            XQueryPointer(display, event.xbutton.window, &event.xbutton.root, &event.xbutton.subwindow, &event.xbutton.x_root, &event.xbutton.y_root, &event.xbutton.x, &event.xbutton.y, &event.xbutton.state);
+        }
+
+        if (XSendEvent(display, PointerWindow, True, 0xfff, &event) == 0)
+        {
+            cerr << "error: failed to simulate click (mousedown)" << endl;
+        }
+        XFlush(display);
+
+        //usleep(100);
+        event.type = ButtonRelease;
+        event.xbutton.state = 0x100;
+        if (XSendEvent(display, PointerWindow, True, 0xfff, &event) == 0)
+        {
+            cerr << "error: failed to simulate click (mouseup)" << endl;
+        }
+
+        XFlush(display);
+    }
+};
+
+// space key from a virtual keyboard (/dev/uinput), bypassing the X server protocol,
+// pointer actions are delegated
+class UInputGameControls : public GameControls
+{
+    GameControls& pointer;
+    int fd;
+    struct input_event events[4];   // space press, sync, release, sync
+
+    static void setEvent(struct input_event& event, int type, int code, int value)
+    {
+        memset(&event, 0, sizeof(event));
+        event.type = type;
+        event.code = code;
+        event.value = value;
+    }
+
+public:
+
+    UInputGameControls(GameControls& pointer) :
+        pointer(pointer),
+        fd(open("/dev/uinput", O_WRONLY | O_NONBLOCK | O_CLOEXEC))
+    {
+        if (fd < 0)
+        {
+            cerr << "error: failed to open /dev/uinput: " << strerror(errno) << endl;
+            return;
+        }
+
+        struct uinput_setup setup;
+        memset(&setup, 0, sizeof(setup));
+        setup.id.bustype = BUS_VIRTUAL;
+        setup.id.vendor = 0x1209;
+        setup.id.product = 0x100b;
+        strncpy(setup.name, "loopgrab keyboard", UINPUT_MAX_NAME_SIZE - 1);
+
+        if (ioctl(fd, UI_SET_EVBIT, EV_KEY) < 0
+            || ioctl(fd, UI_SET_KEYBIT, KEY_SPACE) < 0
+            || ioctl(fd, UI_DEV_SETUP, &setup) < 0
+            || ioctl(fd, UI_DEV_CREATE) < 0)
+        {
+            cerr << "error: failed to create uinput device: " << strerror(errno) << endl;
+            close(fd);
+            fd = -1;
+            return;
+        }
+
+        setEvent(events[0], EV_KEY, KEY_SPACE, 1);
+        setEvent(events[1], EV_SYN, SYN_REPORT, 0);
+        setEvent(events[2], EV_KEY, KEY_SPACE, 0);
+        setEvent(events[3], EV_SYN, SYN_REPORT, 0);
+
+        // the display server needs a moment to pick up the new device
+        this_thread::sleep_for(chrono::milliseconds(500));
+    }
+
+    ~UInputGameControls()
+    {
+        if (fd >= 0)
+        {
+            ioctl(fd, UI_DEV_DESTROY);
+            close(fd);
+        }
+    }
+
+    bool ok() const
+    {
+        return fd >= 0;
+    }
+
+    void fire()
+    {
+        if (write(fd, events, sizeof(events)) != (ssize_t)sizeof(events))
+        {
+            cerr << "error: uinput write failed: " << strerror(errno) << endl;
+        }
+    }
+
+    void focus(int x, int y)
+    {
+        pointer.focus(x, y);
+    }
+
+    void move(int x, int y)
+    {
+        pointer.move(x, y);
+    }
+
+    void click(int x, int y)
+    {
+        pointer.click(x, y);
+    }
+};
+
+
+// game in a window: translate its coordinates to the root window for every pointer action
+class WindowGameControls : public GameControls
+{
+    GameControls& root;
+    Display *display;
+    Window window;
+    Window rootWindow;
+
+    void translate(int& x, int& y)
+    {
+        Window child;
+        XTranslateCoordinates(display, window, rootWindow, x, y, &x, &y, &child);
+    }
+
+public:
+
+    WindowGameControls(GameControls& root, Display *display, Window window, Window rootWindow) :
+        root(root),
+        display(display),
+        window(window),
+        rootWindow(rootWindow)
+    {
+    }
+
+    void fire()
+    {
+        root.fire();
+    }
+
+    void focus(int x, int y)
+    {
+        translate(x, y);
+        root.focus(x, y);
+    }
+
+    void move(int x, int y)
+    {
+        translate(x, y);
+        root.move(x, y);
+    }
+
+    void click(int x, int y)
+    {
+        translate(x, y);
+        root.click(x, y);
+    }
+};
+
+
+class FramePacer
+{
+public:
+
+    virtual ~FramePacer()
+    {
+    }
+
+    // block until the next frame of region (screen coordinates) is worth capturing
+    virtual void wait(const Rect& region) = 0;
+};
+
+class SleepPacer : public FramePacer
+{
+    const chrono::microseconds interval;
+
+public:
+
+    SleepPacer(chrono::microseconds interval) :
+        interval(interval)
+    {
+    }
+
+    void wait(const Rect& region)
+    {
+        (void) region;
+        this_thread::sleep_for(interval);
+    }
+};
+
+// wake up on XDamage reports intersecting the region, instead of polling
+class DamagePacer : public FramePacer
+{
+    Display *display;
+    Damage damage;
+    int eventBase;
+    const chrono::milliseconds timeout;   // keep the game clock going on still screens
+
+    static bool intersects(const XRectangle& area, const Rect& region)
+    {
+        return area.x < region.x1 && area.x + area.width > region.x0
+            && area.y < region.y1 && area.y + area.height > region.y0;
+    }
+
+    // consume pending damage events, leaving other events (i.e. ShmCompletion) queued
+    bool damaged(const Rect& region)
+    {
+        bool changed = false;
+        XEvent event;
+        while (XCheckTypedEvent(display, eventBase + XDamageNotify, &event))
+        {
+            const auto& notify = reinterpret_cast<const XDamageNotifyEvent&>(event);
+            changed = changed || intersects(notify.area, region);
+        }
+        return changed;
+    }
+
+public:
+
+    static bool available(Display *display)
+    {
+        int eventBase;
+        int errorBase;
+        return XDamageQueryExtension(display, &eventBase, &errorBase);
+    }
+
+    DamagePacer(Display *display, Window root, chrono::milliseconds timeout) :
+        display(display),
+        damage(0),
+        eventBase(0),
+        timeout(timeout)
+    {
+        int errorBase;
+        XDamageQueryExtension(display, &eventBase, &errorBase);
+        damage = XDamageCreate(display, root, XDamageReportBoundingBox);
+        XFlush(display);
+    }
+
+    ~DamagePacer()
+    {
+        XDamageDestroy(display, damage);
+    }
+
+    void wait(const Rect& region)
+    {
+        const auto deadline = chrono::steady_clock::now() + timeout;
+        while (!damaged(region))
+        {
+            const auto left = chrono::duration_cast<chrono::milliseconds>(deadline - chrono::steady_clock::now());
+            if (left.count() <= 0)
+            {
+                break;
+            }
+
+            struct pollfd fd;
+            fd.fd = ConnectionNumber(display);
+            fd.events = POLLIN;
+            fd.revents = 0;
+            poll(&fd, 1, (int)left.count());
+        }
+
+        // re-arm: bounding box mode only reports again after the damage got repaired
+        XDamageSubtract(display, damage, None, None);
+        XFlush(display);
+    }
+};
+
+// capture once per refresh of the monitor showing the region (XRandR), at the phase the screen
+// was seen changing (arrival of XDamage reports while waiting): sleep until shortly before the
+// expected change, then spin, since sleeping alone overshoots by up to a timer slack
+class VblankPacer : public FramePacer
+{
+    struct Monitor
+    {
+        Rect bounds;
+        Clock::duration period;
+    };
+
+    Display *display;
+    Damage damage;             // None without XDamage: no phase learning
+    int eventBase;
+    int originX;               // of the paced window on the root, regions and damage are relative to it
+    int originY;
+    vector<Monitor> monitors;
+    int current;               // monitor of the last region
+    Clock::time_point anchor;  // changes expected at anchor + phase + k * period
+    double phase;              // ns
+    bool learned;
+    Clock::time_point last;    // last capture time
+    const Clock::duration spin;
+
+    static double refreshRate(const XRRModeInfo& mode)
+    {
+        double lines = mode.vTotal;
+        if (mode.modeFlags & RR_DoubleScan)
+        {
+            lines *= 2;
+        }
+        if (mode.modeFlags & RR_Interlace)
+        {
+            lines /= 2;
+        }
+        return mode.hTotal > 0 && lines > 0 ? mode.dotClock / (mode.hTotal * lines) : 0;
+    }
+
+    double periodNs() const
+    {
+        return chrono::duration<double, nano>(monitors[current].period).count();
+    }
+
+    void select(const Rect& region)
+    {
+        int found = 0;
+        for (size_t i = 0; i < monitors.size(); ++i)
+        {
+            if (monitors[i].bounds.contains(originX + region.centerX(), originY + region.centerY()))
+            {
+                found = (int)i;
+                break;
+            }
+        }
+        if (found != current)
+        {
+            current = found;
+            learned = false;
+            anchor = Clock::now();
+            phase = 0;
+        }
+    }
+
+    // damage reports: any re-arms the damage, only ones on the monitor are timed and only if they
+    // arrived while polling
+    void drain(bool timed)
+    {
+        const auto now = Clock::now();
+        bool drained = false;
+        bool changed = false;
+        XEvent event;
+        while (XCheckTypedEvent(display, eventBase + XDamageNotify, &event))
+        {
+            const auto& notify = reinterpret_cast<const XDamageNotifyEvent&>(event);
+            const Rect& b = monitors[current].bounds;
+            const int x = originX + notify.area.x;
+            const int y = originY + notify.area.y;
+            drained = true;
+            changed = changed || (x < b.x1 && x + notify.area.width > b.x0 && y < b.y1 && y + notify.area.height > b.y0);
+        }
+        if (!drained)
+        {
+            return;
+        }
+
+        // damage elsewhere would otherwise stay pending and hold back notifies for this monitor
+        XDamageSubtract(display, damage, None, None);
+        XFlush(display);
+        if (changed && timed)
+        {
+            const double period = periodNs();
+            const double offset = fmod(chrono::duration<double, nano>(now - anchor).count(), period);
+            phase = learned ? fmod(phase + remainder(offset - phase, period) / 8 + period, period) : offset;
+            learned = true;
+        }
+    }
+
+public:
+
+    // XRRGetScreenResourcesCurrent() needs RandR 1.3
+    static bool available(Display *display)
+    {
+        int eventBase;
+        int errorBase;
+        int major = 0;
+        int minor = 0;
+        return XRRQueryExtension(display, &eventBase, &errorBase)
+            && XRRQueryVersion(display, &major, &minor)
+            && (major > 1 || (major == 1 && minor >= 3));
+    }
+
+    // paces captures of window (the root or a single window), monitors are found in root coordinates
+    VblankPacer(Display *display, Window window, Clock::duration spin) :
+        display(display),
+        damage(None),
+        eventBase(0),
+        originX(0),
+        originY(0),
+        current(0),
+        anchor(Clock::now()),
+        phase(0),
+        learned(false),
+        last(),
+        spin(spin)
+    {
+        // once: a window moved to another monitor later keeps the pacing it started with
+        XWindowAttributes attributes;
+        Window child;
+        XGetWindowAttributes(display, window, &attributes);
+        XTranslateCoordinates(display, window, attributes.root, 0, 0, &originX, &originY, &child);
+
+        XRRScreenResources *resources = XRRGetScreenResourcesCurrent(display, window);
+        for (int i = 0; resources != nullptr && i < resources->ncrtc; ++i)
+        {
+            XRRCrtcInfo *crtc = XRRGetCrtcInfo(display, resources, resources->crtcs[i]);
+            if (crtc == nullptr)
+            {
+                continue;
+            }
+            for (int m = 0; crtc->mode != None && m < resources->nmode; ++m)
+            {
+                const double rate = refreshRate(resources->modes[m]);
+                if (resources->modes[m].id == crtc->mode && rate > 0)
+                {
+                    const Rect bounds(crtc->x, crtc->y, crtc->x + (int)crtc->width, crtc->y + (int)crtc->height);
+                    monitors.push_back({bounds, chrono::duration_cast<Clock::duration>(chrono::duration<double>(1.0 / rate))});
+                    cerr << "vblank pacer: monitor " << bounds << " at " << fixedPoint(rate, 2) << " Hz" << endl;
+                }
+            }
+            XRRFreeCrtcInfo(crtc);
+        }
+        if (resources != nullptr)
+        {
+            XRRFreeScreenResources(resources);
+        }
+        if (monitors.empty())
+        {
+            cerr << "warning: vblank pacer: no active monitor found, assuming 60 Hz" << endl;
+            monitors.push_back({Rect(0, 0, INT32_MAX, INT32_MAX), chrono::microseconds(16667)});
+        }
+
+        int errorBase;
+        if (XDamageQueryExtension(display, &eventBase, &errorBase))
+        {
+            damage = XDamageCreate(display, window, XDamageReportBoundingBox);
+            XFlush(display);
+        }
+        else
+        {
+            cerr << "warning: vblank pacer: no XDamage, refresh phase is not learned" << endl;
+        }
+    }
+
+    ~VblankPacer()
+    {
+        if (damage != None)
+        {
+            XDamageDestroy(display, damage);
+        }
+    }
+
+    void wait(const Rect& region)
+    {
+        select(region);
+        if (damage != None)
+        {
+            drain(false);
+        }
+
+        // next expected change, at most one per refresh
+        const double period = periodNs();
+        const auto base = anchor + chrono::duration_cast<Clock::duration>(chrono::duration<double, nano>(phase));
+        auto now = Clock::now();
+        const auto after = max(now, last + monitors[current].period / 2);
+        const double k = ceil(chrono::duration<double, nano>(after - base).count() / period);
+        const auto target = base + chrono::duration_cast<Clock::duration>(chrono::duration<double, nano>(k * period));
+
+        for (; now + spin < target; now = Clock::now())
+        {
+            const auto left = chrono::duration_cast<chrono::nanoseconds>(target - spin - now);
+            if (damage == None)
+            {
+                this_thread::sleep_for(left);
+                continue;
+            }
+
+            struct pollfd fd;
+            fd.fd = ConnectionNumber(display);
+            fd.events = POLLIN;
+            fd.revents = 0;
+            struct timespec timeout;
+            timeout.tv_sec = left.count() / 1000000000;
+            timeout.tv_nsec = left.count() % 1000000000;
+            if (ppoll(&fd, 1, &timeout, nullptr) > 0)
+            {
+                drain(true);
+            }
+        }
+        while (Clock::now() < target)
+        {
+            // spin
+        }
+        last = target;
+    }
+};
+
+// capture file: CaptureHeader, then per frame a CaptureRecord followed by its rows
+// (bounds.width() * 4 bytes each, BGRA) padded to 8 bytes
+struct CaptureHeader
+{
+    char magic[8];
+    int32_t width;      // screen
+    int32_t height;
+};
+
+struct CaptureRecord
+{
+    int64_t timestamp;  // steady clock, ns
+    int32_t x0;
+    int32_t y0;
+    int32_t x1;
+    int32_t y1;
+    int32_t stride;
+    int32_t reserved;
+
+    size_t size() const
+    {
+        return (sizeof(CaptureRecord) + (size_t)stride * (y1 - y0) + 7) & ~(size_t)7;
+    }
+};
+
+static const char captureMagic[8] = {'L', 'G', 'R', 'A', 'B', '0', '1', '\0'};
+
+
+// append frames to a capture file through a growing shared mapping
+class FrameRecorder
+{
+    int fd;
+    uint8_t *map;
+    size_t capacity;
+    size_t size;
+
+    bool reserve(size_t n)
+    {
+        if (size + n <= capacity)
+        {
+            return true;
+        }
+
+        const size_t grown = max(max(capacity * 2, size + n), (size_t)64 << 20);
+        void *remapped = ftruncate(fd, grown) == 0
+            ? (map ? mremap(map, capacity, grown, MREMAP_MAYMOVE) : mmap(NULL, grown, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0))
+            : MAP_FAILED;
+        if (remapped == MAP_FAILED)
+        {
+            cerr << "error: failed to grow capture file: " << strerror(errno) << endl;
+            return false;
+        }
+        map = static_cast<uint8_t*>(remapped);
+        capacity = grown;
+        return true;
+    }
+
+public:
+
+    FrameRecorder(const string& path, const Rect& screen) :
+        fd(open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644)),
+        map(nullptr),
+        capacity(0),
+        size(0)
+    {
+        if (fd < 0)
+        {
+            cerr << "error: failed to open capture file " << path << ": " << strerror(errno) << endl;
+            return;
+        }
+
+        if (reserve(sizeof(CaptureHeader)))
+        {
+            CaptureHeader *header = reinterpret_cast<CaptureHeader*>(map);
+            memcpy(header->magic, captureMagic, sizeof(captureMagic));
+            header->width = screen.width();
+            header->height = screen.height();
+            size = sizeof(CaptureHeader);
+        }
+    }
+
+    ~FrameRecorder()
+    {
+        if (map)
+        {
+            munmap(map, capacity);
+        }
+        if (fd >= 0)
+        {
+            // drop the unused tail of the last growth step
+            if (ftruncate(fd, size) != 0)
+            {
+                cerr << "error: failed to truncate capture file: " << strerror(errno) << endl;
+            }
+            close(fd);
+        }
+    }
+
+    bool ok() const
+    {
+        return map != nullptr;
+    }
+
+    void append(const PixelView& v, Clock::time_point t)
+    {
+        CaptureRecord record;
+        memset(&record, 0, sizeof(record));
+        record.timestamp = chrono::duration_cast<chrono::nanoseconds>(t.time_since_epoch()).count();
+        record.x0 = v.bounds.x0;
+        record.y0 = v.bounds.y0;
+        record.x1 = v.bounds.x1;
+        record.y1 = v.bounds.y1;
+        record.stride = v.bounds.width() * sizeof(uint32_t);
+
+        if (!ok() || !reserve(record.size()))
+        {
+            return;
+        }
+
+        uint8_t *p = map + size;
+        memcpy(p, &record, sizeof(record));
+        p += sizeof(record);
+        for (int y = v.bounds.y0; y < v.bounds.y1; ++y, p += record.stride)
+        {
+            memcpy(p, v.at(v.bounds.x0, y), record.stride);
+        }
+        size += record.size();
+    }
+};
+
+
+// records every frame of another GameFrame
+class RecordingFrame : public GameFrame
+{
+    unique_ptr<GameFrame> frame;
+    FrameRecorder& recorder;
+    bool warned;
+
+public:
+
+    RecordingFrame(unique_ptr<GameFrame> frame, FrameRecorder& recorder) :
+        frame(move(frame)),
+        recorder(recorder),
+        warned(false)
+    {
+    }
+
+    void next()
+    {
+        frame->next();
+
+        const PixelView v = frame->view();
+        if (v.valid())
+        {
+            recorder.append(v, frame->timestamp());
+        }
+        else if (!warned)
+        {
+            cerr << "error: can only record 32 bpp BGRA frames" << endl;
+            warned = true;
+        }
+    }
+
+    void setRegion(const Rect& region)
+    {
+        frame->setRegion(region);
+    }
+
+    Pixel getPixel(int x, int y) const
+    {
+        return frame->getPixel(x, y);
+    }
+
+    PixelView view() const
+    {
+        return frame->view();
+    }
+
+    Clock::time_point timestamp() const
+    {
+        return frame->timestamp();
+    }
+
+    void savePng(const string path) const
+    {
+        frame->savePng(path);
+    }
+
+    bool repeated() const
+    {
+        return frame->repeated();
+    }
+};
+
+
+// plays back a capture file, pixels are read straight from the (read-only) mapping
+class ReplayFrame : public GameFrame
+{
+    int fd;
+    const uint8_t *map;
+    size_t mapSize;
+    Rect screen;
+
+    size_t offset;      // of the current record, 0 before the first next()
+    const CaptureRecord *record;
+    uint64_t frames;
+
+    size_t following() const
+    {
+        return offset == 0 ? sizeof(CaptureHeader) : offset + record->size();
+    }
+
+public:
+
+    ReplayFrame(const string& path) :
+        fd(open(path.c_str(), O_RDONLY)),
+        map(nullptr),
+        mapSize(0),
+        offset(0),
+        record(nullptr),
+        frames(0)
+    {
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0)
+        {
+            cerr << "error: failed to open capture file " << path << ": " << strerror(errno) << endl;
+            return;
+        }
+
+        mapSize = st.st_size;
+        const CaptureHeader *header = nullptr;
+        if (mapSize >= sizeof(CaptureHeader))
+        {
+            void *p = mmap(NULL, mapSize, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED)
+            {
+                map = static_cast<const uint8_t*>(p);
+                header = reinterpret_cast<const CaptureHeader*>(map);
+            }
+        }
+
+        if (header == nullptr || memcmp(header->magic, captureMagic, sizeof(captureMagic)) != 0)
+        {
+            cerr << "error: " << path << " is not a capture file" << endl;
+            return;
+        }
+
+        screen = Rect(0, 0, header->width, header->height);
+        madvise(const_cast<uint8_t*>(map), mapSize, MADV_SEQUENTIAL);
+    }
+
+    ~ReplayFrame()
+    {
+        if (map)
+        {
+            munmap(const_cast<uint8_t*>(map), mapSize);
+        }
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+    }
+
+    bool ok() const
+    {
+        return screen.width() > 0;
+    }
+
+    const Rect& bounds() const
+    {
+        return screen;
+    }
+
+    uint64_t frameCount() const
+    {
+        return frames;
+    }
+
+    // is there a complete frame after the current one?
+    bool hasNext() const
+    {
+        if (!ok())
+        {
+            return false;
+        }
+
+        const size_t o = following();
+        if (o + sizeof(CaptureRecord) > mapSize)
+        {
+            return false;
+        }
+        return o + reinterpret_cast<const CaptureRecord*>(map + o)->size() <= mapSize;
+    }
+
+    void next()
+    {
+        if (hasNext())
+        {
+            offset = following();
+            record = reinterpret_cast<const CaptureRecord*>(map + offset);
+            ++frames;
+        }
+    }
+
+    void setRegion(const Rect& region)
+    {
+        // whatever got recorded
+        (void) region;
+    }
+
+    Pixel getPixel(int x, int y) const
+    {
+        const PixelView v = view();
+        return v.valid() && v.bounds.contains(x, y) ? Pixel(*v.at(x, y)) : Pixel();
+    }
+
+    PixelView view() const
+    {
+        if (record == nullptr)
+        {
+            return PixelView();
+        }
+        return PixelView(reinterpret_cast<const uint8_t*>(record + 1), record->stride, Rect(record->x0, record->y0, record->x1, record->y1));
+    }
+
+    Clock::time_point timestamp() const
+    {
+        return record ? Clock::time_point(chrono::nanoseconds(record->timestamp)) : Clock::time_point();
+    }
+
+    void savePng(const string path) const
+    {
+        const PixelView v = view();
+        if (v.valid())
+        {
+            ::savePng(path, v.bounds.width(), v.bounds.height(), [&](int y, uint32_t *row)
+            {
+                memcpy(row, v.at(v.bounds.x0, v.bounds.y0 + y), v.bounds.width() * sizeof(uint32_t));
+            });
+        }
+    }
+};
+
+
+// logs fire events with the frame timestamp, optionally forwarding everything to real controls
+class RecordingControls : public GameControls
+{
+    GameControls *controls;
+    const GameFrame& frame;
+    ostream& log;
+    uint64_t fires;
+
+public:
+
+    RecordingControls(GameControls *controls, const GameFrame& frame, ostream& log) :
+        controls(controls),
+        frame(frame),
+        log(log),
+        fires(0)
+    {
+    }
+
+    void fire()
+    {
+        if (controls)
+        {
+            controls->fire();
+        }
+        log << dec << "fire " << fires++ << " t=" << chrono::duration_cast<chrono::nanoseconds>(frame.timestamp().time_since_epoch()).count() << endl;
+    }
+
+    void move(int x, int y)
+    {
+        if (controls)
+        {
+            controls->move(x, y);
+        }
+    }
+
+    void click(int x, int y)
+    {
+        if (controls)
+        {
+            controls->click(x, y);
+        }
+    }
+
+    void focus(int x, int y)
+    {
+        if (controls)
+        {
+            controls->focus(x, y);
+        }
+    }
+};
+
+
+// looptap like scene without X server: ring track with a target arc and the ball on it
+class SyntheticFrame : public GameFrame
+{
+public:
+
+    static inline const Pixel backgroundColor = {0xff, 0xff, 0xff, 0x00};
+    static inline const Pixel targetColor = {0x5c, 0x4c, 0xe7, 0x00};
+
+private:
+
+    Rect screen;
+    Rect region;
+    vector<uint32_t> pixels;
+    double centerX;
+    double centerY;
+    double radius;
+    int trackWidth;
+    int ballSize;
+    double ballAngle;
+    bool ballVisible;
+    double arcStart;        // radians, no target if arcLength is 0
+    double arcLength;
+    double speed;           // radians per next()
+    int noise;              // maximum color channel error
+    Rect drawn;             // pixels covered by the ball
+    Clock::time_point time;
+    Clock::duration interval;
+
+    bool onTarget(double angle) const
+    {
+        double d = remainder(angle - arcStart, twoPi);
+        if (d < 0)
+        {
+            d += twoPi;
+        }
+        return d < arcLength;
+    }
+
+    // color c off by up to noise per channel, the same for each pixel on every frame
+    uint32_t shade(uint32_t c, int x, int y) const
+    {
+        if (noise == 0)
+        {
+            return c;
+        }
+
+        uint32_t h = ((uint32_t)x * 0x9e3779b1u) ^ ((uint32_t)y * 0x85ebca77u);
+        h ^= h >> 15;
+        h *= 0x2c1b3c6du;
+        h ^= h >> 12;
+        uint32_t shaded = c & ~colorMask;
+        for (int channel = 0; channel < 3; ++channel)
+        {
+            const int v = (int)((c >> (8 * channel)) & 0xff) + (int)((h >> (8 * channel)) % (2 * noise + 1)) - noise;
+            shaded |= (uint32_t)min(255, max(0, v)) << (8 * channel);
+        }
+        return shaded;
+    }
+
+    // scene without the ball
+    uint32_t scene(int x, int y) const
+    {
+        const double dx = x - centerX;
+        const double dy = y - centerY;
+        if (fabs(sqrt(dx * dx + dy * dy) - radius) > trackWidth / 2.0)
+        {
+            return shade(backgroundColor.c, x, y);
+        }
+        return shade(onTarget(atan2(dy, dx)) ? targetColor.c : Game::fieldColor.c, x, y);
+    }
+
+    void fill(const Rect& r)
+    {
+        for (int y = r.y0; y < r.y1; ++y)
+        {
+            for (int x = r.x0; x < r.x1; ++x)
+            {
+                pixels[(size_t)y * screen.width() + x] = scene(x, y);
+            }
+        }
+    }
+
+    void drawBall()
+    {
+        fill(drawn);
+        drawn = Rect();
+        if (!ballVisible)
+        {
+            return;
+        }
+
+        // integer center keeps the ball symmetric, so its bounds are square like in the browser
+        const int bx = (int)lround(centerX + radius * cos(ballAngle));
+        const int by = (int)lround(centerY + radius * sin(ballAngle));
+        const double r = ballSize / 2.0;
+        const int extent = (int)r;
+        drawn = Rect(bx - extent, by - extent, bx + extent + 1, by + extent + 1);
+        drawn.clip(screen);
+        for (int y = drawn.y0; y < drawn.y1; ++y)
+        {
+            for (int x = drawn.x0; x < drawn.x1; ++x)
+            {
+                if ((x - bx) * (x - bx) + (y - by) * (y - by) <= r * r)
+                {
+                    pixels[(size_t)y * screen.width() + x] = shade(Game::ballColor.c, x, y);
+                }
+            }
+        }
+    }
+
+public:
+
+    SyntheticFrame(int width, int height, double radius, int ballSize) :
+        screen(0, 0, width, height),
+        region(screen),
+        pixels((size_t)width * height),
+        centerX(width / 2),
+        centerY(height / 2),
+        radius(radius),
+        trackWidth(ballSize + 10),
+        ballSize(ballSize),
+        ballAngle(0),
+        ballVisible(true),
+        arcStart(0),
+        arcLength(0),
+        speed(0),
+        noise(0),
+        time(Clock::now()),
+        interval(chrono::microseconds(16667))
+    {
+        fill(screen);
+        drawBall();
+    }
+
+    const Rect& bounds() const
+    {
+        return screen;
+    }
+
+    double angle() const
+    {
+        return ballAngle;
+    }
+
+    bool ballOnTarget() const
+    {
+        return ballVisible && onTarget(ballAngle);
+    }
+
+    // move ball to angle (radians, clockwise from 3 o'clock)
+    void setBall(double angle, bool visible = true)
+    {
+        ballAngle = remainder(angle, twoPi);
+        ballVisible = visible;
+        drawBall();
+    }
+
+    void setTarget(double start, double length)
+    {
+        arcStart = start;
+        arcLength = length;
+
+        // only the track changes
+        const int extent = (int)ceil(radius + trackWidth / 2.0) + 1;
+        Rect track((int)centerX - extent, (int)centerY - extent, (int)centerX + extent + 1, (int)centerY + extent + 1);
+        track.clip(screen);
+        fill(track);
+        drawBall();
+    }
+
+    // color error as from scaling or color management, up to amplitude per channel
+    void setNoise(int amplitude)
+    {
+        noise = amplitude;
+        fill(screen);
+        drawBall();
+    }
+
+    // ball movement and clock advance per next()
+    void setSpeed(double radiansPerFrame, Clock::duration frameInterval)
+    {
+        speed = radiansPerFrame;
+        interval = frameInterval;
+    }
+
+    // ball rect as found by Game (inclusive bounds)
+    Rect ballRect() const
+    {
+        return Rect(drawn.x0, drawn.y0, drawn.x1 - 1, drawn.y1 - 1);
+    }
+
+    void next()
+    {
+        if (speed != 0)
+        {
+            setBall(ballAngle + speed, ballVisible);
+        }
+        time += interval;
+    }
+
+    void setRegion(const Rect& r)
+    {
+        region = captureRegion(r, screen);
+    }
+
+    Pixel getPixel(int x, int y) const
+    {
+        return region.contains(x, y) ? Pixel(pixels[(size_t)y * screen.width() + x]) : Pixel();
+    }
+
+    PixelView view() const
+    {
+        const uint32_t *origin = pixels.data() + (size_t)region.y0 * screen.width() + region.x0;
+        return PixelView(reinterpret_cast<const uint8_t*>(origin), screen.width() * sizeof(uint32_t), region);
+    }
+
+    Clock::time_point timestamp() const
+    {
+        return time;
+    }
+
+    void savePng(const string path) const
+    {
+        const PixelView v = view();
+        ::savePng(path, region.width(), region.height(), [&](int y, uint32_t *row)
+        {
+            memcpy(row, v.at(region.x0, region.y0 + y), region.width() * sizeof(uint32_t));
+        });
+    }
+};
+
+
+// closed loop looptap to measure accuracy against latency without playing live: fire() lands after
+// the input latency, a hit moves the target and speeds the ball up, a miss ends the round (its
+// score is the hits before) and the next one starts over at the initial speed. Frames show
+// the game as it was capture latency before they are grabbed. Time is simulated (frame interval per
+// next(), analysis takes none), jitter is uniform in [0, jitter] from a fixed seed, so runs repeat.
+class Simulator : public SyntheticFrame, public GameControls
+{
+public:
+
+    struct Settings
+    {
+        double speed = 3;                   // initial ball speed, radians per second
+        double speedup = 1.03;              // factor per hit
+        double maxSpeed = 4 * M_PI;
+        double arcLength = M_PI / 8;
+        Clock::duration interval = chrono::microseconds(16667);
+        Clock::duration captureLatency = chrono::milliseconds(0);
+        Clock::duration inputLatency = chrono::milliseconds(0);
+        Clock::duration jitter = chrono::milliseconds(0);
+    };
+
+private:
+
+    struct State
+    {
+        Clock::time_point time;
+        double angle;
+        double speed;           // radians per second, 0 until the first fire starts the game
+        double arcStart;
+        double arcLength;
+
+        // the ball moved on to t (not past the next change)
+        State at(Clock::time_point t) const
+        {
+            State s = *this;
+            s.angle = remainder(angle + speed * chrono::duration<double>(t - time).count(), twoPi);
+            s.time = t;
+            return s;
+        }
+    };
+
+    const Settings settings;
+    mt19937 random;
+    State world;                    // the game right now
+    deque<State> history;           // world after the recent changes, for capture latency
+    deque<Clock::time_point> landings;  // of pending fires, ascending
+    State shown;
+
+    uint64_t frames;
+    uint64_t fires;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t score;                 // of the current round
+    uint64_t rounds;                // ended by a miss
+    uint64_t bestScore;
+    Clock::time_point started;
+
+    Clock::duration jitter()
+    {
+        if (settings.jitter <= Clock::duration::zero())
+        {
+            return Clock::duration::zero();
+        }
+        return Clock::duration(uniform_int_distribution<Clock::rep>(0, settings.jitter.count())(random));
+    }
+
+    static bool onTarget(const State& s)
+    {
+        double d = remainder(s.angle - s.arcStart, twoPi);
+        if (d < 0)
+        {
+            d += twoPi;
+        }
+        return d < s.arcLength;
+    }
+
+    // the first key press starts the game, every later one scores
+    void land()
+    {
+        if (world.speed == 0)
+        {
+            world.speed = settings.speed;
+            return;
+        }
+
+        ++fires;
+        if (onTarget(world))
+        {
+            ++hits;
+            bestScore = max(bestScore, ++score);
+            world.arcStart = remainder(world.angle + uniform_real_distribution<double>(M_PI / 2, 3 * M_PI / 2)(random), twoPi);
+            world.speed = min(settings.maxSpeed, world.speed * settings.speedup);
+        }
+        else
+        {
+            ++misses;
+            ++rounds;
+            score = 0;
+            world.speed = settings.speed;
+        }
+    }
+
+    void advance(Clock::time_point t)
+    {
+        while (!landings.empty() && landings.front() <= t)
+        {
+            world = world.at(landings.front());
+            landings.pop_front();
+            land();
+            history.push_back(world);
+        }
+        world = world.at(t);
+    }
+
+    void show(const State& s)
+    {
+        if (s.arcStart != shown.arcStart || s.arcLength != shown.arcLength)
+        {
+            setTarget(s.arcStart, s.arcLength);
+        }
+        if (s.angle != shown.angle)
+        {
+            setBall(s.angle);
+        }
+        shown = s;
+    }
+
+public:
+
+    Simulator(int width, int height, double radius, int ballSize, const Settings& settings) :
+        SyntheticFrame(width, height, radius, ballSize),
+        settings(settings),
+        random(1),
+        world(),
+        shown(),
+        frames(0),
+        fires(0),
+        hits(0),
+        misses(0),
+        score(0),
+        rounds(0),
+        bestScore(0),
+        started(timestamp())
+    {
+        setSpeed(0, settings.interval);
+        world.time = timestamp();
+        world.angle = -M_PI / 2;
+        world.speed = 0;
+        world.arcStart = M_PI / 4;
+        world.arcLength = settings.arcLength;
+        shown = world;
+        setTarget(world.arcStart, world.arcLength);
+        setBall(world.angle);
+        history.push_back(world);
+    }
+
+    void next()
+    {
+        SyntheticFrame::next();
+        ++frames;
+        const Clock::time_point now = timestamp();
+        advance(now);
+
+        // the world as it was capture latency ago, changes older than that are no longer needed
+        const Clock::time_point visible = now - settings.captureLatency - jitter();
+        const Clock::time_point oldest = now - settings.captureLatency - settings.jitter;
+        while (history.size() > 1 && history[1].time <= oldest)
+        {
+            history.pop_front();
+        }
+        size_t i = 0;
+        while (i + 1 < history.size() && history[i + 1].time <= visible)
+        {
+            ++i;
+        }
+        show(history[i].time < visible ? history[i].at(visible) : history[i]);
+    }
+
+    // lands input latency after the grab of the frame that led to it
+    void fire()
+    {
+        const Clock::time_point t = timestamp() + settings.inputLatency + jitter();
+        auto i = landings.end();
+        while (i != landings.begin() && *(i - 1) > t)
+        {
+            --i;
+        }
+        landings.insert(i, t);
+    }
+
+    void move(int x, int y)
+    {
+        (void) x;
+        (void) y;
+    }
+
+    void click(int x, int y)
+    {
+        (void) x;
+        (void) y;
+    }
+
+    void focus(int x, int y)
+    {
+        (void) x;
+        (void) y;
+    }
+
+    void report(ostream& os, Clock::duration elapsed) const
+    {
+        const double simulated = chrono::duration<double>(timestamp() - started).count();
+        const double wall = chrono::duration<double>(elapsed).count();
+        // the round still running counts as if it ended now
+        const uint64_t played = rounds + (score > 0 ? 1 : 0);
+        os << "simulation: frames=" << frames << ", fires=" << fires << ", hits=" << hits << ", misses=" << misses
+            << ", hit rate=" << fixedPoint(fires > 0 ? 100.0 * hits / fires : 0, 1) << "%"
+            << ", rounds=" << played << ", mean score=" << fixedPoint(played > 0 ? (double)hits / played : 0, 1) << ", best=" << bestScore << endl
+            << "simulation: " << fixedPoint(simulated, 1) << " s simulated in " << fixedPoint(wall, 3) << " s ("
+            << fixedPoint(wall > 0 ? simulated / wall : 0, 1) << "x real time, " << fixedPoint(wall > 0 ? frames / wall : 0, 1) << " fps)" << endl;
+    }
+};
+
+
+// micro benchmarks of the Game detection hot paths on synthetic (and recorded) frames
+class GameBench
+{
+    static const int width = 1920;
+    static const int height = 1080;
+    static const int radius = 250;
+
+    NullControls controls;
+    ostream& out;
+    uint64_t sink;      // keeps results alive
+
+    void report(const string& name, double ns, double pixels, const string& unit)
+    {
+        out << left << setw(36) << name << right
+            << setw(12) << fixedPoint(ns, 1) << " ns/" << unit
+            << setw(12) << fixedPoint(pixels, 1) << " px/" << unit << endl;
+    }
+
+    // repeat op, doubling the count until it takes at least 100 ms
+    template <typename Op>
+    void measure(const string& name, Game& game, Op op)
+    {
+        for (uint64_t n = 1; ; n *= 2)
+        {
+            const uint64_t pixels = game.touched;
+            const auto start = Clock::now();
+            for (uint64_t i = 0; i < n; ++i)
+            {
+                sink += op();
+            }
+            const auto elapsed = Clock::now() - start;
+            if (elapsed >= chrono::milliseconds(100) || n >= ((uint64_t)1 << 26))
+            {
+                report(name, chrono::duration<double, nano>(elapsed).count() / n, (double)(game.touched - pixels) / n, "op");
+                return;
+            }
+        }
+    }
+
+    static string label(const string& name, int size)
+    {
+        return name + " d=" + to_string(size);
+    }
+
+    void ball(int size)
+    {
+        SyntheticFrame frame(width, height, radius, size);
+        frame.setBall(-M_PI / 4);
+        const Rect actual = frame.ballRect();
+
+        Game game(controls, width, height, 1);
+        game.view = frame.view();
+        game.field = Rect(width / 2 - radius - size * 2, height / 2 - radius - size * 2, width / 2 + radius + size * 2, height / 2 + radius + size * 2);
+
+        measure(label("checkForBall", size), game, [&]()
+        {
+            Blob b;
+            return game.checkForBall(frame, actual.centerX(), actual.centerY(), b);
+        });
+
+        measure(label("extractComponent", size), game, [&]()
+        {
+            Blob b;
+            return game.extractComponent(frame, actual.centerX(), actual.centerY(), Game::ballClass, width, b)
+                && b.bounds == actual;
+        });
+
+        // previous ball a bit behind: found by the edge probes
+        frame.setBall(-M_PI / 4 - (size / 4.0) / radius);
+        const Rect behind = frame.ballRect();
+        frame.setBall(-M_PI / 4);
+        game.view = frame.view();
+        measure(label("findBall follow", size), game, [&]()
+        {
+            game.ball = behind;
+            return game.findBall(frame, game.field);
+        });
+
+        // fast ball two widths on since the last frame: found around where its last move predicts it
+        frame.setBall(-M_PI / 4 - 2.0 * size / radius);
+        const Rect before = frame.ballRect();
+        frame.setBall(-M_PI / 4);
+        const Clock::time_point t = game.frameTime;
+        measure(label("findBall fast (predicted)", size), game, [&]()
+        {
+            game.motion.reset();
+            game.motion.add(2 * before.centerX() - actual.centerX(), 2 * before.centerY() - actual.centerY(), t - chrono::milliseconds(34));
+            game.motion.add(before.centerX(), before.centerY(), t - chrono::milliseconds(17));
+            game.ball = before;
+            return game.findBall(frame, game.field) && game.ball == actual;
+        });
+        game.motion.reset();
+
+        // previous ball on the other side: zone scan of the field
+        frame.setBall(3 * M_PI / 4);
+        const Rect lost = frame.ballRect();
+        frame.setBall(-M_PI / 4);
+        measure(label("findBall lost", size), game, [&]()
+        {
+            game.ball = lost;
+            return game.findBall(frame, game.field);
+        });
+
+        // same along the calibrated ring
+        game.ball = lost;
+        game.setRing(width / 2, height / 2, radius);
+        measure(label("findBall lost (ring)", size), game, [&]()
+        {
+            game.ball = lost;
+            return game.findBall(frame, game.field);
+        });
+
+        // zone scan of the field only where the ball can be on the ring
+        game.maskField();
+        game.ringRadius = 0;
+        measure(label("findBall lost (masked)", size), game, [&]()
+        {
+            game.ball = lost;
+            return game.findBall(frame, game.field);
+        });
+        game.fieldMask.clear();
+
+        // no ball known yet: coarse to fine scan of the whole screen, 16 then 4 pixel grid
+        measure(label("findBall cold", size), game, [&]()
+        {
+            game.ball = Rect();
+            return game.findBall(frame, game.screen);
+        });
+
+        frame.setBall(3 * M_PI / 4);
+        measure(label("findBall cold (bottom left)", size), game, [&]()
+        {
+            game.ball = Rect();
+            return game.findBall(frame, game.screen);
+        });
+    }
+
+    void empty()
+    {
+        SyntheticFrame frame(width, height, radius, 16);
+        frame.setBall(0, false);
+
+        Game game(controls, width, height, 1);
+        game.view = frame.view();
+        measure("findBall cold (no ball)", game, [&]()
+        {
+            game.ball = Rect();
+            return game.findBall(frame, game.screen);
+        });
+
+        WorkerPool workers(max(2u, thread::hardware_concurrency()));
+        game.setWorkerPool(&workers);
+        measure("findBall cold (no ball) " + to_string(workers.size()) + " threads", game, [&]()
+        {
+            game.ball = Rect();
+            return game.findBall(frame, game.screen);
+        });
+
+        // small ball (only on the 4 pixel grid) late in the scan
+        SyntheticFrame small(width, height, radius, 8);
+        small.setBall(M_PI / 2);
+        game.view = small.view();
+        game.setWorkerPool(nullptr);
+        measure("findBall cold (bottom) d=8", game, [&]()
+        {
+            game.ball = Rect();
+            return game.findBall(small, game.screen);
+        });
+        game.setWorkerPool(&workers);
+        measure("findBall cold (bottom) d=8 " + to_string(workers.size()) + " threads", game, [&]()
+        {
+            game.ball = Rect();
+            return game.findBall(small, game.screen);
+        });
+    }
+
+    // colors off by a few levels: exact matching rescans for a ball it can't find
+    void noisy(int size)
+    {
+        SyntheticFrame frame(width, height, radius, size);
+        frame.setNoise(3);
+        frame.setBall(-M_PI / 4);
+        const Rect actual = frame.ballRect();
+        for (int tolerance : {0, 4})
+        {
+            Game game(controls, width, height, 1);
+            game.view = frame.view();
+            game.setTolerance(tolerance);
+            measure(label("findBall cold (noise, tol " + to_string(tolerance) + ")", size), game, [&]()
+            {
+                game.ball = Rect();
+                return game.findBall(frame, game.screen) && game.ball == actual;
+            });
+        }
+    }
+
+    void steps(int size)
+    {
+        SyntheticFrame frame(width, height, radius, size);
+        frame.setSpeed(0.05, chrono::microseconds(16667));
+
+        // cold start: frames until the field is known
+        Game game(controls, width, height, 1);
+        int frames = 0;
+        const uint64_t pixels = game.touched;
+        const auto start = Clock::now();
+        while (!game.haveField() && frames < 10000)
+        {
+            game.step(frame);
+            ++frames;
+        }
+        const double ns = chrono::duration<double, nano>(Clock::now() - start).count();
+        report(label("cold start (" + to_string(frames) + " frames)", size), ns, (double)(game.touched - pixels), "start");
+
+        measure(label("step tracking", size), game, [&]()
+        {
+            return game.step(frame);
+        });
+    }
+
+    void recorded(const string& path)
+    {
+        ReplayFrame frame(path);
+        if (!frame.ok())
+        {
+            return;
+        }
+
+        Game game(controls, frame.bounds().width(), frame.bounds().height(), 1);
+        const uint64_t pixels = game.touched;
+        const auto start = Clock::now();
+        while (frame.hasNext() && game.step(frame))
+        {
+        }
+        const double ns = chrono::duration<double, nano>(Clock::now() - start).count();
+        const uint64_t frames = max((uint64_t)1, frame.frameCount());
+        report("step recorded (" + to_string(frame.frameCount()) + " frames)", ns / frames, (double)(game.touched - pixels) / frames, "frame");
+    }
+
+public:
+
+    GameBench(ostream& out) :
+        out(out),
+        sink(0)
+    {
+    }
+
+    int run(const string& recording)
+    {
+        out << "pixel kernel: " << findPixelName << ", screen: " << width << "x" << height << endl;
+        for (int size : {8, 16, 32, 64})
+        {
+            ball(size);
+        }
+        empty();
+        noisy(16);
+        for (int size : {8, 16, 32})
+        {
+            steps(size);
+        }
+        if (!recording.empty())
+        {
+            recorded(recording);
+        }
+        return sink == 0 ? 1 : 0;
+    }
+};
+
+
+unique_ptr<FramePacer> createPacer(Display *display, Window root, const string& pacing)
+{
+    if (pacing == "vblank")
+    {
+        if (VblankPacer::available(display))
+        {
+            return unique_ptr<FramePacer>(new VblankPacer(display, root, chrono::microseconds(300)));
+        }
+        cerr << "warning: XRandR 1.3 not available, falling back to damage pacing" << endl;
+    }
+    if (pacing == "damage" || pacing == "vblank")
+    {
+        if (DamagePacer::available(display))
+        {
+            return unique_ptr<FramePacer>(new DamagePacer(display, root, chrono::milliseconds(100)));
+        }
+        cerr << "warning: XDamage extension not available, falling back to sleep pacing" << endl;
+    }
+    return unique_ptr<FramePacer>(new SleepPacer(chrono::milliseconds(1)));
+}
+
+
+// capture on a separate thread (and X connection) into a triple buffer: the capture thread
+// always owns one slot, the game owns another and the third holds the latest finished frame,
+// swapped lock-free, so stale frames get dropped and neither side ever waits on the other
+class PipelinedFrame : public GameFrame
+{
+    static const unsigned slotCount = 3;
+    static const unsigned fresh = 0x100;    // set in latest while the game hasn't taken it yet
+
+    Display *display;
+    Window root;
+    unique_ptr<XImageFrame> slots[slotCount];
+    unique_ptr<FramePacer> pacer;
+
+    atomic<unsigned> latest;
+    unsigned reader;
+    atomic<bool> running;
+
+    mutex regionLock;   // region changes are rare, only the frame handoff is lock-free
+    Rect region;
+    atomic<bool> regionChanged;
+
+    thread capture;
+
+    void run()
+    {
+        unsigned writer = 2;
+        Rect want;
+        while (running.load(memory_order_relaxed))
+        {
+            if (regionChanged.exchange(false, memory_order_acquire))
+            {
+                lock_guard<mutex> lock(regionLock);
+                want = region;
+            }
+
+            pacer->wait(want);
+
+            // segments are only re-created on the slot owned by this thread
+            slots[writer]->setRegion(want);
+            slots[writer]->next();
+
+            writer = latest.exchange(writer | fresh, memory_order_acq_rel) & ~fresh;
+        }
+    }
+
+public:
+
+    PipelinedFrame(Display *mainDisplay, const string& pacing) :
+        display(XOpenDisplay(DisplayString(mainDisplay))),
+        root(XDefaultRootWindow(display)),
+        latest(1),
+        reader(0),
+        running(true),
+        region(),
+        regionChanged(false)
+    {
+        for (auto& slot : slots)
+        {
+            slot.reset(new XImageFrame(display, root));
+        }
+        pacer = createPacer(display, root, pacing);
+
+        capture = thread(&PipelinedFrame::run, this);
+    }
+
+    thread& captureThread()
+    {
+        return capture;
+    }
+
+    ~PipelinedFrame()
+    {
+        running = false;
+        capture.join();
+
+        pacer.reset();
+        for (auto& slot : slots)
+        {
+            slot.reset();
+        }
+        XCloseDisplay(display);
+    }
+
+    void next()
+    {
+        // wait for a frame newer than the one we hold
+        for (int spin = 0; !(latest.load(memory_order_acquire) & fresh); ++spin)
+        {
+            if (spin < 64)
+            {
+                this_thread::yield();
+            }
+            else
+            {
+                this_thread::sleep_for(chrono::microseconds(100));
+            }
+        }
+        reader = latest.exchange(reader, memory_order_acq_rel) & ~fresh;
+    }
+
+    void setRegion(const Rect& r)
+    {
+        lock_guard<mutex> lock(regionLock);
+        region = r;
+        regionChanged.store(true, memory_order_release);
+    }
+
+    Pixel getPixel(int x, int y) const
+    {
+        return slots[reader]->getPixel(x, y);
+    }
+
+    PixelView view() const
+    {
+        return slots[reader]->view();
+    }
+
+    Clock::time_point timestamp() const
+    {
+        return slots[reader]->timestamp();
+    }
+
+    void savePng(const string path) const
+    {
+        slots[reader]->savePng(path);
+    }
+};
+
+
+#ifdef LOOPGRAB_PIPEWIRE
+
+// PipeWire screencast stream, e.g. the node of an xdg-desktop-portal ScreenCast session
+// (reached through PIPEWIRE_REMOTE). PipeWire maps the shared buffers (memfd or DMA-BUF) once,
+// the newest one is handed to the game without copying and returned on the following next()
+class PipeWireFrame : public GameFrame
+{
+    pw_thread_loop *loop;
+    pw_context *context;
+    pw_core *core;
+    pw_stream *stream;
+    pw_stream_events events;
+    spa_hook listener;
+
+    mutex lock;                     // guards the members up to failed, taken inside the loop lock
+    condition_variable arrived;
+    spa_video_info_raw format;
+    pw_buffer *pending;             // newest filled buffer, not yet taken by next()
+    Clock::time_point pendingTime;
+    bool failed;
+
+    pw_buffer *current;             // owned by the game until the following next()
+    Clock::time_point currentTime;
+    bool repeat;                    // no new buffer arrived for the current frame
+    Rect screen;
+    Rect requested;
+    Rect region;
+    PixelView frameView;            // whole current buffer
+
+    static void onStateChanged(void *data, pw_stream_state old, pw_stream_state state, const char *error)
+    {
+        (void) old;
+        PipeWireFrame *self = static_cast<PipeWireFrame*>(data);
+        if (state == PW_STREAM_STATE_ERROR || state == PW_STREAM_STATE_UNCONNECTED)
+        {
+            if (error != nullptr)
+            {
+                cerr << "error: PipeWire stream " << pw_stream_state_as_string(state) << ": " << error << endl;
+            }
+            lock_guard<mutex> guard(self->lock);
+            self->failed = true;
+            self->arrived.notify_all();
+        }
+    }
+
+    static void onParamChanged(void *data, uint32_t id, const spa_pod *param)
+    {
+        PipeWireFrame *self = static_cast<PipeWireFrame*>(data);
+        uint32_t mediaType;
+        uint32_t mediaSubtype;
+        if (param == nullptr
+            || id != SPA_PARAM_Format
+            || spa_format_parse(param, &mediaType, &mediaSubtype) < 0
+            || mediaType != SPA_MEDIA_TYPE_video
+            || mediaSubtype != SPA_MEDIA_SUBTYPE_raw)
+        {
+            return;
+        }
+
+        spa_video_info_raw raw;
+        memset(&raw, 0, sizeof(raw));
+        if (spa_format_video_raw_parse(param, &raw) < 0)
+        {
+            return;
+        }
+        {
+            lock_guard<mutex> guard(self->lock);
+            self->format = raw;
+        }
+
+        // a spare buffer for the compositor while we hold two, in any memory PipeWire can map
+        uint8_t buffer[256];
+        spa_pod_builder b;
+        spa_pod_builder_init(&b, buffer, sizeof(buffer));
+        spa_pod_frame object;
+        spa_pod_frame choice;
+        spa_pod_builder_push_object(&b, &object, SPA_TYPE_OBJECT_ParamBuffers, SPA_PARAM_Buffers);
+        spa_pod_builder_prop(&b, SPA_PARAM_BUFFERS_buffers, 0);
+        spa_pod_builder_push_choice(&b, &choice, SPA_CHOICE_Range, 0);
+        spa_pod_builder_int(&b, 4);
+        spa_pod_builder_int(&b, 3);
+        spa_pod_builder_int(&b, 8);
+        spa_pod_builder_pop(&b, &choice);
+        spa_pod_builder_prop(&b, SPA_PARAM_BUFFERS_dataType, 0);
+        spa_pod_builder_push_choice(&b, &choice, SPA_CHOICE_Flags, 0);
+        spa_pod_builder_int(&b, (1 << SPA_DATA_MemPtr) | (1 << SPA_DATA_MemFd) | (1 << SPA_DATA_DmaBuf));
+        spa_pod_builder_pop(&b, &choice);
+        const spa_pod *params[1] = {static_cast<const spa_pod*>(spa_pod_builder_pop(&b, &object))};
+        pw_stream_update_params(self->stream, params, 1);
+    }
+
+    // on the loop thread: keep only the newest buffer, return older ones right away
+    static void onProcess(void *data)
+    {
+        PipeWireFrame *self = static_cast<PipeWireFrame*>(data);
+        pw_buffer *newest = nullptr;
+        while (pw_buffer *b = pw_stream_dequeue_buffer(self->stream))
+        {
+            if (newest != nullptr)
+            {
+                pw_stream_queue_buffer(self->stream, newest);
+            }
+            newest = b;
+        }
+        if (newest == nullptr)
+        {
+            return;
+        }
+
+        const spa_data& d = newest->buffer->datas[0];
+        if (d.data == nullptr || d.chunk->size == 0 || (d.chunk->flags & SPA_CHUNK_FLAG_CORRUPTED))
+        {
+            pw_stream_queue_buffer(self->stream, newest);
+            return;
+        }
+
+        lock_guard<mutex> guard(self->lock);
+        if (self->pending != nullptr)
+        {
+            pw_stream_queue_buffer(self->stream, self->pending);
+        }
+        self->pending = newest;
+        self->pendingTime = Clock::now();
+        self->arrived.notify_one();
+    }
+
+    // CPU access to DMA-BUF memory must be bracketed for cache coherency
+    static void syncDmaBuf(pw_buffer *b, uint64_t flags)
+    {
+        const spa_data& d = b->buffer->datas[0];
+        if (d.type == SPA_DATA_DmaBuf)
+        {
+            struct dma_buf_sync sync;
+            sync.flags = flags | DMA_BUF_SYNC_READ;
+            ioctl((int)d.fd, DMA_BUF_IOCTL_SYNC, &sync);
         }
     }
 
-
 public:
 
-    Game(GameControls& controls, int width, int height, int deadzoneFrames) :
-        controls(controls),
-        width(width),
-        height(height),
-        screen(0, 0, width, height),
-        ball(0, 0, 0, 0),
-        field(0, 0, 0, 0),
-        frameCount(0),
-        lastFire(0),
-        lastBall(time(NULL)),
-        lastBallMove(time(NULL)),
-        deadzoneFrames(deadzoneFrames),
-        ignoredCount(0),
-        hasFired(false)
+    // node PW_ID_ANY lets the session manager pick a video source
+    PipeWireFrame(uint32_t node) :
+        loop(nullptr),
+        context(nullptr),
+        core(nullptr),
+        stream(nullptr),
+        pending(nullptr),
+        failed(false),
+        current(nullptr),
+        repeat(false)
     {
+        pw_init(nullptr, nullptr);
+        memset(&events, 0, sizeof(events));
+        events.version = PW_VERSION_STREAM_EVENTS;
+        events.state_changed = onStateChanged;
+        events.param_changed = onParamChanged;
+        events.process = onProcess;
+        memset(&format, 0, sizeof(format));
+
+        loop = pw_thread_loop_new("loopgrab-capture", nullptr);
+        context = pw_context_new(pw_thread_loop_get_loop(loop), nullptr, 0);
+        pw_thread_loop_lock(loop);
+        pw_thread_loop_start(loop);
+        core = pw_context_connect(context, nullptr, 0);
+        if (core == nullptr)
+        {
+            pw_thread_loop_unlock(loop);
+            cerr << "error: failed to connect to PipeWire: " << strerror(errno) << endl;
+            failed = true;
+            return;
+        }
+
+        stream = pw_stream_new(core, "loopgrab", pw_properties_new(
+            PW_KEY_MEDIA_TYPE, "Video",
+            PW_KEY_MEDIA_CATEGORY, "Capture",
+            PW_KEY_MEDIA_ROLE, "Screen",
+            nullptr));
+        pw_stream_add_listener(stream, &listener, &events, this);
+
+        // 32 bpp BGRx like the X path, any size and rate
+        uint8_t buffer[512];
+        spa_pod_builder b;
+        spa_pod_builder_init(&b, buffer, sizeof(buffer));
+        spa_pod_frame object;
+        spa_pod_frame choice;
+        spa_pod_builder_push_object(&b, &object, SPA_TYPE_OBJECT_Format, SPA_PARAM_EnumFormat);
+        spa_pod_builder_prop(&b, SPA_FORMAT_mediaType, 0);
+        spa_pod_builder_id(&b, SPA_MEDIA_TYPE_video);
+        spa_pod_builder_prop(&b, SPA_FORMAT_mediaSubtype, 0);
+        spa_pod_builder_id(&b, SPA_MEDIA_SUBTYPE_raw);
+        spa_pod_builder_prop(&b, SPA_FORMAT_VIDEO_format, 0);
+        spa_pod_builder_push_choice(&b, &choice, SPA_CHOICE_Enum, 0);
+        spa_pod_builder_id(&b, SPA_VIDEO_FORMAT_BGRx);
+        spa_pod_builder_id(&b, SPA_VIDEO_FORMAT_BGRx);
+        spa_pod_builder_id(&b, SPA_VIDEO_FORMAT_BGRA);
+        spa_pod_builder_pop(&b, &choice);
+        spa_pod_builder_prop(&b, SPA_FORMAT_VIDEO_size, 0);
+        spa_pod_builder_push_choice(&b, &choice, SPA_CHOICE_Range, 0);
+        spa_pod_builder_rectangle(&b, 1920, 1080);
+        spa_pod_builder_rectangle(&b, 1, 1);
+        spa_pod_builder_rectangle(&b, 16384, 16384);
+        spa_pod_builder_pop(&b, &choice);
+        spa_pod_builder_prop(&b, SPA_FORMAT_VIDEO_framerate, 0);
+        spa_pod_builder_push_choice(&b, &choice, SPA_CHOICE_Range, 0);
+        spa_pod_builder_fraction(&b, 60, 1);
+        spa_pod_builder_fraction(&b, 0, 1);
+        spa_pod_builder_fraction(&b, 1000, 1);
+        spa_pod_builder_pop(&b, &choice);
+        const spa_pod *params[1] = {static_cast<const spa_pod*>(spa_pod_builder_pop(&b, &object))};
+
+        const int result = pw_stream_connect(stream, PW_DIRECTION_INPUT, node,
+            static_cast<pw_stream_flags>(PW_STREAM_FLAG_AUTOCONNECT | PW_STREAM_FLAG_MAP_BUFFERS), params, 1);
+        pw_thread_loop_unlock(loop);
+        if (result < 0)
+        {
+            cerr << "error: failed to connect PipeWire stream: " << strerror(-result) << endl;
+            failed = true;
+            return;
+        }
+
+        // the first buffer tells the screen size
+        next();
+        if (current == nullptr)
+        {
+            cerr << "error: no frame from PipeWire node " << node << endl;
+        }
     }
 
-    ~Game()
+    ~PipeWireFrame()
     {
+        if (current != nullptr)
+        {
+            syncDmaBuf(current, DMA_BUF_SYNC_END);
+        }
+        pw_thread_loop_stop(loop);
+        if (stream != nullptr)
+        {
+            pw_stream_destroy(stream);
+        }
+        if (core != nullptr)
+        {
+            pw_core_disconnect(core);
+        }
+        pw_context_destroy(context);
+        pw_thread_loop_destroy(loop);
+        pw_deinit();
     }
 
-    bool step(GameFrame& frame)
+    bool ok() const
     {
-        bool hadField = haveField();
+        return current != nullptr;
+    }
 
-        bool keepPlaying; 
-        if (!hadField)
+    const Rect& bounds() const
+    {
+        return screen;
+    }
+
+    void next()
+    {
+        pw_buffer *taken = nullptr;
+        Clock::time_point t;
+        spa_video_info_raw f;
         {
-            frame.next();
+            unique_lock<mutex> guard(lock);
+            arrived.wait_for(guard, chrono::milliseconds(current != nullptr ? 100 : 2000), [this]() { return pending != nullptr || failed; });
+            taken = pending;
+            pending = nullptr;
+            t = pendingTime;
+            f = format;
+        }
 
-            const Rect lastField = field;
-            keepPlaying = expandField(frame);
-            if (keepPlaying)
+        if (taken == nullptr)
+        {
+            // compositors only send changes: the screen still looks like this now
+            currentTime = Clock::now();
+            repeat = current != nullptr;
+            return;
+        }
+        repeat = false;
+
+        if (current != nullptr)
+        {
+            syncDmaBuf(current, DMA_BUF_SYNC_END);
+            pw_thread_loop_lock(loop);
+            pw_stream_queue_buffer(stream, current);
+            pw_thread_loop_unlock(loop);
+        }
+
+        current = taken;
+        currentTime = t;
+        syncDmaBuf(current, DMA_BUF_SYNC_START);
+        const spa_data& d = current->buffer->datas[0];
+        screen = Rect(0, 0, (int)f.size.width, (int)f.size.height);
+        region = captureRegion(requested, screen);
+        const int stride = d.chunk->stride > 0 ? d.chunk->stride : screen.width() * (int)sizeof(uint32_t);
+        frameView = PixelView(static_cast<const uint8_t*>(d.data) + d.chunk->offset, stride, screen);
+    }
+
+    // buffers always hold the whole stream, the region just restricts the view on it
+    void setRegion(const Rect& r)
+    {
+        requested = r;
+        region = captureRegion(requested, screen);
+    }
+
+    Pixel getPixel(int x, int y) const
+    {
+        return current != nullptr && region.contains(x, y) ? Pixel(*frameView.at(x, y)) : Pixel();
+    }
+
+    PixelView view() const
+    {
+        if (current == nullptr)
+        {
+            return PixelView();
+        }
+        return PixelView(reinterpret_cast<const uint8_t*>(frameView.at(region.x0, region.y0)), frameView.stride, region);
+    }
+
+    Clock::time_point timestamp() const
+    {
+        return currentTime;
+    }
+
+    bool repeated() const
+    {
+        return repeat;
+    }
+
+    void savePng(const string path) const
+    {
+        const PixelView v = view();
+        if (!v.valid())
+        {
+            return;
+        }
+        ::savePng(path, region.width(), region.height(), [&](int y, uint32_t *row)
+        {
+            memcpy(row, v.at(region.x0, region.y0 + y), region.width() * sizeof(uint32_t));
+        });
+    }
+};
+
+#endif
+
+
+// opt-in real-time mode for the threads between capture and fire: SCHED_FIFO, pinned to CPUs
+// and all memory locked (so resident before the first frame). Every step reports, failures
+// (usually missing CAP_SYS_NICE / CAP_IPC_LOCK or rtprio / memlock limits) only warn
+class Realtime
+{
+    int priority;           // SCHED_FIFO, 0 keeps normal scheduling
+    vector<int> cpus;       // threads are pinned to these in turn, empty for no pinning
+
+    static void report(const string& step, int error)
+    {
+        if (error == 0)
+        {
+            cerr << "realtime: " << step << ": ok" << endl;
+        }
+        else
+        {
+            cerr << "warning: realtime: " << step << ": " << strerror(error) << endl;
+        }
+    }
+
+public:
+
+    Realtime(int priority, const vector<int>& cpus) :
+        priority(priority),
+        cpus(cpus)
+    {
+    }
+
+    // "0,2-3"
+    static bool parseCpus(const string& list, vector<int>& cpus)
+    {
+        cpus.clear();
+        size_t i = 0;
+        while (i < list.size())
+        {
+            size_t end = list.find(',', i);
+            if (end == string::npos)
             {
-                if (lastField == field && field == ball)
+                end = list.size();
+            }
+            const string item = list.substr(i, end - i);
+            const size_t dash = item.find('-');
+            char *rest = nullptr;
+            const long first = strtol(item.c_str(), &rest, 10);
+            const long last = dash == string::npos ? first : strtol(item.c_str() + dash + 1, &rest, 10);
+            if (item.empty() || *rest != '\0' || first < 0 || last < first || last >= CPU_SETSIZE)
+            {
+                return false;
+            }
+            for (long cpu = first; cpu <= last; ++cpu)
+            {
+                cpus.push_back((int)cpu);
+            }
+            i = end + 1;
+        }
+        return !cpus.empty();
+    }
+
+    // index picks the CPU (round robin)
+    void apply(thread::native_handle_type handle, int index, const string& name) const
+    {
+        if (priority > 0)
+        {
+            sched_param param = {};
+            param.sched_priority = priority;
+            report(name + ": SCHED_FIFO priority " + to_string(priority), pthread_setschedparam(handle, SCHED_FIFO, &param));
+        }
+        if (!cpus.empty())
+        {
+            const int cpu = cpus[index % cpus.size()];
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(cpu, &set);
+            report(name + ": pinned to CPU " + to_string(cpu), pthread_setaffinity_np(handle, sizeof(set), &set));
+        }
+    }
+
+    // after all buffers are allocated: MCL_FUTURE makes later allocations fail beyond
+    // RLIMIT_MEMLOCK, so only without a limit (shm segments created later are pre-faulted by ShmImage)
+    void lockMemory() const
+    {
+        if (priority <= 0)
+        {
+            return;
+        }
+
+        rlimit limit = {};
+        getrlimit(RLIMIT_MEMLOCK, &limit);
+        const bool future = limit.rlim_cur == RLIM_INFINITY || geteuid() == 0;
+        const int flags = future ? MCL_CURRENT | MCL_FUTURE : MCL_CURRENT;
+        report(future ? "memory locked (current and future)" : "memory locked (current, RLIMIT_MEMLOCK is limited)", mlockall(flags) == 0 ? 0 : errno);
+    }
+};
+
+
+struct Options
+{
+    string pacing = "damage";   // damage | vblank | sleep
+    string input = "xtest";     // xtest | xtest-sync | uinput
+    bool pipeline = false;
+    string pipewire;            // capture this PipeWire node ("any" for the default) instead of X
+    string window;              // capture only this X window (id, name or "pointer")
+    bool predict = false;
+    chrono::microseconds lead = chrono::microseconds(0);
+    bool calibrate = false;     // learn lead and dead zone during play
+    chrono::seconds statsInterval = chrono::seconds(10);
+    chrono::microseconds deadzone = chrono::microseconds(0);
+    chrono::microseconds timeout = chrono::seconds(2);
+    string record;              // capture file to write
+    string replay;              // capture file to play back instead of grabbing the screen
+    string fireLog;
+    string snapshots;           // path prefix for fire/stop snapshots
+    int pngLevel = 1;
+    int threads = 1;            // for zone scans of a lost or unknown ball
+    int tolerance = 0;          // per channel, for matching field and ball colors
+    int games = 1;              // side by side on the screen
+    int realtime = 0;           // SCHED_FIFO priority of the capture and game threads, 0 for normal
+    vector<int> cpus;           // to pin those threads to
+    bool bench = false;
+    uint64_t simulate = 0;      // frames to play against the simulator, 0 to play for real
+    Simulator::Settings simulation;
+
+    static bool value(const string& arg, const string& name, string& value)
+    {
+        const string prefix = "--" + name + "=";
+        if (arg.compare(0, prefix.size(), prefix) != 0)
+        {
+            return false;
+        }
+        value = arg.substr(prefix.size());
+        return true;
+    }
+
+    bool parse(int argc, char *argv[])
+    {
+        for (int i = 1; i < argc; ++i)
+        {
+            const string arg = argv[i];
+            string v;
+            if (value(arg, "pacing", pacing))
+            {
+                if (pacing != "damage" && pacing != "vblank" && pacing != "sleep")
                 {
-                    // initial space keypress to start game (if ball doesn't move)
-                    controls.focus(ball.centerX(), ball.centerY());
-                    controls.fire();
-                    expand(field);
-                    cerr << "[" << frameCount << "] game started" << endl;
+                    cerr << "error: unknown pacing: " << pacing << endl;
+                    return false;
                 }
-                else if (haveField())
+            }
+            else if (value(arg, "input", input))
+            {
+                if (input != "xtest" && input != "xtest-sync" && input != "uinput")
                 {
-                    // finally add safety margin to the playing field
-                    addFieldSafetyMargin();
-                    controls.move(field.x1, field.y1);  // move away to not block view
-                    cerr << "[" << frameCount << "] game field: " << field << endl;
+                    cerr << "error: unknown input: " << input << endl;
+                    return false;
+                }
+            }
+            else if (value(arg, "pipewire", pipewire))
+            {
+#ifndef LOOPGRAB_PIPEWIRE
+                cerr << "error: built without PipeWire support (make PIPEWIRE=1)" << endl;
+                return false;
+#endif
+            }
+            else if (value(arg, "window", window))
+            {
+                // resolved once the display is open
+            }
+            else if (arg == "--pipeline")
+            {
+                pipeline = true;
+            }
+            else if (arg == "--predict")
+            {
+                predict = true;
+            }
+            else if (arg == "--calibrate")
+            {
+                predict = true;
+                calibrate = true;
+            }
+            else if (value(arg, "lead", v))
+            {
+                predict = true;
+                lead = chrono::microseconds((long long)(atof(v.c_str()) * 1000));
+            }
+            else if (value(arg, "deadzone", v))
+            {
+                deadzone = chrono::microseconds((long long)(atof(v.c_str()) * 1000));
+            }
+            else if (value(arg, "timeout", v))
+            {
+                timeout = chrono::microseconds((long long)(atof(v.c_str()) * 1000));
+            }
+            else if (value(arg, "stats", v))
+            {
+                statsInterval = chrono::seconds(atoi(v.c_str()));
+            }
+            else if (value(arg, "png-level", v))
+            {
+                pngLevel = atoi(v.c_str());
+                if (pngLevel < 0 || pngLevel > 9)
+                {
+                    cerr << "error: PNG compression level must be 0-9: " << v << endl;
+                    return false;
+                }
+            }
+            else if (value(arg, "threads", v))
+            {
+                threads = v == "auto" ? (int)max(1u, thread::hardware_concurrency()) : atoi(v.c_str());
+                if (threads < 1)
+                {
+                    cerr << "error: --threads must be at least 1: " << v << endl;
+                    return false;
+                }
+            }
+            else if (arg == "--realtime")
+            {
+                realtime = 50;
+            }
+            else if (value(arg, "realtime", v))
+            {
+                realtime = atoi(v.c_str());
+                if (realtime < 1 || realtime > 99)
+                {
+                    cerr << "error: --realtime priority must be 1-99: " << v << endl;
+                    return false;
+                }
+            }
+            else if (value(arg, "cpus", v))
+            {
+                if (!Realtime::parseCpus(v, cpus))
+                {
+                    cerr << "error: invalid CPU list: " << v << endl;
+                    return false;
+                }
+            }
+            else if (value(arg, "games", v))
+            {
+                games = atoi(v.c_str());
+                if (games < 1)
+                {
+                    cerr << "error: --games must be at least 1: " << v << endl;
+                    return false;
+                }
+            }
+            else if (value(arg, "tolerance", v))
+            {
+                tolerance = atoi(v.c_str());
+                if (tolerance < 0 || tolerance > 255)
+                {
+                    cerr << "error: --tolerance must be 0-255: " << v << endl;
+                    return false;
                 }
             }
-        }
-        else
-        {
-            frame.next();
-
-            if (findBall(frame, field))
+            else if (arg == "--bench")
+            {
+                bench = true;
+            }
+            else if (arg == "--simulate")
             {
-                Rect ballBox = ball;
-                expand(ballBox);
-                if (isBallSurrounded(frame, ballBox))
+                simulate = 36000;
+            }
+            else if (value(arg, "simulate", v))
+            {
+                simulate = strtoull(v.c_str(), nullptr, 10);
+                if (simulate == 0)
                 {
-                    if (!hasFired)
-                    {
-                        // ball surrounded by non-field color: consider firing
-                        hasFired = fire();
-                    }
+                    cerr << "error: --simulate needs at least one frame: " << v << endl;
+                    return false;
                 }
-                else
+            }
+            else if (value(arg, "sim-speed", v))
+            {
+                simulation.speed = atof(v.c_str());
+                if (simulation.speed <= 0)
                 {
-                    hasFired = false;
+                    cerr << "error: --sim-speed must be positive: " << v << endl;
+                    return false;
                 }
-
-                // timeout after 2 s of ball not moving
-                keepPlaying = time(NULL) - lastBallMove < 2;
-                if (!keepPlaying)
+            }
+            else if (value(arg, "sim-fps", v))
+            {
+                const double fps = atof(v.c_str());
+                if (fps <= 0)
                 {
-                    cerr << "[" << frameCount << "] game stopped" << endl;
+                    cerr << "error: --sim-fps must be positive: " << v << endl;
+                    return false;
                 }
+                simulation.interval = chrono::duration_cast<Clock::duration>(chrono::duration<double>(1 / fps));
+            }
+            else if (value(arg, "sim-capture-latency", v))
+            {
+                simulation.captureLatency = chrono::microseconds((long long)(atof(v.c_str()) * 1000));
+            }
+            else if (value(arg, "sim-input-latency", v))
+            {
+                simulation.inputLatency = chrono::microseconds((long long)(atof(v.c_str()) * 1000));
+            }
+            else if (value(arg, "sim-jitter", v))
+            {
+                simulation.jitter = chrono::microseconds((long long)(atof(v.c_str()) * 1000));
+            }
+            else if (value(arg, "record", record) || value(arg, "replay", replay) || value(arg, "fire-log", fireLog) || value(arg, "snapshots", snapshots))
+            {
+                // just file names
             }
             else
             {
-                // timeout after 2s of not seeing any ball
-                keepPlaying = time(NULL) - lastBall < 2;
+                cerr << "error: unknown argument: " << arg << endl;
+                usage(argv[0]);
+                return false;
             }
         }
 
-        ++frameCount;
+        if (!pipewire.empty() && pipeline)
+        {
+            cerr << "error: --pipeline only applies to X capture, not --pipewire" << endl;
+            return false;
+        }
 
-        return keepPlaying;
+        if (!window.empty() && (pipeline || !pipewire.empty()))
+        {
+            cerr << "error: --window can't be combined with --pipeline or --pipewire" << endl;
+            return false;
+        }
+
+        if (games > 1 && !window.empty())
+        {
+            cerr << "error: --games needs the whole screen, not --window" << endl;
+            return false;
+        }
+
+        if (!record.empty() && !replay.empty())
+        {
+            cerr << "error: --record and --replay are mutually exclusive" << endl;
+            return false;
+        }
+
+        if (simulate > 0 && (!replay.empty() || !record.empty() || games > 1))
+        {
+            cerr << "error: --simulate can't be combined with --replay, --record or --games" << endl;
+            return false;
+        }
+        return true;
+    }
+
+    static void usage(const char *name)
+    {
+        cerr << "usage: " << name << " [options]" << endl
+            << "  --pacing=<mode>         capture on XDamage reports (damage, default), once per monitor refresh" << endl
+            << "                          at the phase the screen changes (vblank) or every 1 ms (sleep)" << endl
+            << "  --input=<backend>       fire with xtest (default), xtest-sync (XSync after the key events) or uinput" << endl
+            << "  --pipewire=<node>|any   capture a PipeWire screencast (Wayland) instead of the X root window" << endl
+            << "  --window=<id>|<name>|pointer  capture only this window (via XComposite, even if covered)" << endl
+            << "  --pipeline              capture on a separate thread while analysing the previous frame" << endl
+            << "  --predict               fire on the predicted arrival of the ball at the target" << endl
+            << "  --lead=<ms>             with --predict: fire this much earlier to compensate latency" << endl
+            << "  --calibrate             --predict and learn lead and dead zone from the latency of hits, saved per" << endl
+            << "                          host in $XDG_CONFIG_HOME/loopgrab/calibration (not by --replay/--simulate)" << endl
+            << "  --deadzone=<ms>         minimum time between two fires (default 0, at least one frame)" << endl
+            << "  --timeout=<ms>          stop when the ball didn't move or wasn't seen for this long (default 2000)" << endl
+            << "  --stats=<s>             dump latency statistics every s seconds (default 10, 0 only at exit)" << endl
+            << "  --record=<file>         append all captured frames to file" << endl
+            << "  --replay=<file>         play back a recorded file instead of the screen (no X server needed)" << endl
+            << "  --fire-log=<file>       log fire events with frame timestamps (stderr during replay)" << endl
+            << "  --snapshots=<prefix>    save the field to <prefix>fire-<frame>.png on every fire and on game stop" << endl
+            << "  --png-level=<0-9>       zlib level of snapshots (default 1)" << endl
+            << "  --threads=<n>|auto      search a lost or unknown ball with n threads (default 1)" << endl
+            << "  --tolerance=<n>         accept field and ball colors off by up to n per channel (default 0: exact)" << endl
+            << "  --games=<n>             play n games (windows side by side) on one capture of the screen" << endl
+            << "  --realtime[=<prio>]     SCHED_FIFO (default priority 50) for capture and game threads, lock memory" << endl
+            << "  --cpus=<list>           pin capture and game threads to these CPUs (e.g. 2,3 or 2-3)" << endl
+            << "  --bench                 run detection benchmarks (on synthetic frames and the --replay file)" << endl
+            << "  --simulate[=<frames>]   play a simulated game (default 36000 frames) as fast as possible, report hit rate" << endl
+            << "  --sim-speed=<rad/s>     initial ball speed of the simulation (default 3, 3% faster per hit)" << endl
+            << "  --sim-fps=<hz>          simulated frame rate (default 60)" << endl
+            << "  --sim-capture-latency=<ms>  age of the simulated screen when grabbed (default 0)" << endl
+            << "  --sim-input-latency=<ms>    delay of simulated fires (default 0)" << endl
+            << "  --sim-jitter=<ms>       add up to this much to each simulated capture and input latency" << endl;
     }
 };
 
 
-class XImageFrame : public GameFrame
+// apply the options to a game (number index of several)
+void setupGame(Game& game, int index, const Options& options, WorkerPool& workers, SnapshotWriter *snapshots, const Calibration& calibration)
 {
-    Display *display;
-    Window root;
-
-    XImage *image;
-    XShmSegmentInfo shminfo;
-    int completionType;
+    game.setWorkerPool(&workers);
+    game.setPrediction(options.predict, options.lead);
+    game.setCalibration(options.calibrate, calibration);
+    game.setDeadzone(options.deadzone);
+    game.setTolerance(options.tolerance);
+    game.setTimeouts(options.timeout, options.timeout);
+    game.setSnapshots(snapshots, options.games > 1 ? options.snapshots + "game" + to_string(index) + "-" : options.snapshots);
+}
 
-public:
 
-    XImageFrame(Display *display, Window root) :
-        display(display),
-        root(root),
-        completionType(XShmGetEventBase(display) + ShmCompletion)
+// keep what the games learned for the next run on this host, weighted by their hits this run (they
+// all started from the same estimate)
+void saveCalibration(const vector<const Game*>& games)
+{
+    Calibration learned;
+    uint64_t added = 0;
+    double latency = 0;
+    double lead = 0;
+    for (const Game *game : games)
     {
-        auto shm_ext = XInitExtension(display, "MIT-SHM");
-        if (!shm_ext->extension)
+        const LatencyCalibrator& calibrator = game->calibration();
+        const uint64_t n = calibrator.count();
+        if (n == 0)
         {
-            cerr << "error: MIT-SHM extension not available" << endl;
+            continue;
         }
+        added += n;
+        latency += chrono::duration<double>(calibrator.calibration().latency).count() * n;
+        lead += chrono::duration<double>(calibrator.calibration().lead).count() * n;
+        learned.samples = max(learned.samples, calibrator.calibration().samples - n);
+    }
+    if (added == 0)
+    {
+        return;
+    }
+    learned.latency = chrono::duration_cast<Clock::duration>(chrono::duration<double>(latency / added));
+    learned.lead = chrono::duration_cast<Clock::duration>(chrono::duration<double>(lead / added));
+    learned.samples += added;
 
-        XWindowAttributes root_attr;
-        XGetWindowAttributes(display, root, &root_attr);
-
-        image = XShmCreateImage(display, DefaultVisualOfScreen(root_attr.screen), root_attr.depth, ZPixmap, NULL, &shminfo, root_attr.width, root_attr.height); 
-
-        shminfo.shmid = shmget(IPC_PRIVATE, image->bytes_per_line * image->height, IPC_CREAT|0777);
-        shminfo.shmaddr = image->data = (char*) shmat(shminfo.shmid, 0, 0);
-        shminfo.readOnly = False;
+    if (!learned.save())
+    {
+        cerr << "warning: failed to save calibration to " << Calibration::directory() << endl;
+        return;
+    }
+    cerr << "calibration: saved latency=" << fixedPoint(chrono::duration<double, milli>(learned.latency).count(), 1)
+        << " ms, lead=" << fixedPoint(chrono::duration<double, milli>(learned.lead).count(), 1) << " ms ("
+        << added << " new hits) to " << Calibration::directory() << "/calibration" << endl;
+}
 
-        auto stat = XShmAttach(display, &shminfo);
-        if (!stat)
-        {
-            cerr << "error: XShmAttach() failed" << endl;
-        }
 
-        //cerr << "ext=" << shm_ext->extension << ", shmid=" << shminfo.shmid << ", shmaddr=" << (uintptr_t)shminfo.shmaddr << ", vis=" << (uintptr_t)root_attr.visual << ", depth=" << root_attr.depth << ", width=" << root_attr.width << ", height=" << root_attr.height << ", stat=" << stat << ", completionType=" << completionType << endl;
+// offline: feed recorded frames as fast as possible
+int replay(const Options& options)
+{
+    ReplayFrame frame(options.replay);
+    if (!frame.ok())
+    {
+        return 1;
     }
 
-    ~XImageFrame()
+    ofstream fireLog;
+    if (!options.fireLog.empty())
     {
-        XShmDetach(display, &shminfo);
-        XDestroyImage(image);
-        shmdt(shminfo.shmaddr);
-        shmctl(shminfo.shmid, IPC_RMID, NULL);
+        fireLog.open(options.fireLog);
     }
+    RecordingControls controls(nullptr, frame, options.fireLog.empty() ? cerr : fireLog);
 
+    cerr << "replay: " << options.replay << ", screen: " << frame.bounds() << endl;
 
-    void next()
+    unique_ptr<SnapshotWriter> snapshots;
+    if (!options.snapshots.empty())
     {
-        auto success = XShmGetImage(display, root, image, 0, 0, AllPlanes);
-        if (!success)
+        snapshots.reset(new SnapshotWriter((size_t)frame.bounds().width() * frame.bounds().height(), options.pngLevel));
+    }
+
+    const Calibration calibration;
+    WorkerPool workers(options.threads);
+    if (options.games > 1)
+    {
+        GameSupervisor supervisor(frame, controls, frame.bounds().width(), frame.bounds().height(), options.games, [&](Game& game, int index)
+        {
+            setupGame(game, index, options, workers, snapshots.get(), calibration);
+        });
+        while (frame.hasNext() && supervisor.step())
         {
-            cerr << "error: XShmGetImage() failed" << endl;
         }
-
-        //image = XShmGetImage(display, root, field.x0, field.y0, field.width(), field.height(), AllPlanes, XYPixmap);
-        //cerr << "image: data=" << (uintptr_t)image->data
-        //    << ", byte_order=" << image->byte_order
-        //    << ", depth=" << image->depth
-        //    << ", bytes_per_line=" << image->bytes_per_line
-        //    << ", bits_per_pixel=" << image->bits_per_pixel
-        //    << endl;
+        cerr << "replay: " << frame.frameCount() << " frames" << endl;
+        supervisor.dump(cerr);
+    }
+    else
+    {
+        Game game(controls, frame.bounds().width(), frame.bounds().height(), 1);
+        setupGame(game, 0, options, workers, snapshots.get(), calibration);
+        while (frame.hasNext() && game.step(frame))
+        {
+        }
+        cerr << "replay: " << frame.frameCount() << " frames" << endl;
+        game.instrumentation().dump(cerr);
+    }
+    if (snapshots)
+    {
+        snapshots->dump(cerr);
     }
+    return 0;
+}
 
 
-    Pixel getPixel(int x, int y) const
+// offline: play against the simulator as fast as possible
+int simulate(const Options& options)
+{
+    Simulator simulator(1920, 1080, 250, 16, options.simulation);
+    cerr << "simulate: " << options.simulate << " frames, screen: " << simulator.bounds() << endl;
+
+    unique_ptr<SnapshotWriter> snapshots;
+    if (!options.snapshots.empty())
     {
-        return Pixel(image->f.get_pixel(image, x, y));
+        snapshots.reset(new SnapshotWriter((size_t)simulator.bounds().width() * simulator.bounds().height(), options.pngLevel));
     }
 
+    const Calibration calibration;
+    WorkerPool workers(options.threads);
+    Game game(simulator, simulator.bounds().width(), simulator.bounds().height(), 1);
+    setupGame(game, 0, options, workers, snapshots.get(), calibration);
+    const auto start = Clock::now();
+    for (uint64_t i = 0; i < options.simulate && game.step(simulator); ++i)
+    {
+    }
+    const auto elapsed = Clock::now() - start;
+    game.instrumentation().dump(cerr);
+    simulator.report(cerr, elapsed);
+    if (snapshots)
+    {
+        snapshots->dump(cerr);
+    }
+    return 0;
+}
 
-    void savePng(const string path) const
+
+// live game: capture the X root window (or a PipeWire stream) and control through X (or uinput)
+int play(Display *display, const Options& options)
+{
+    const Realtime realtime(options.realtime, options.cpus);
+    ShmImage::prefault = options.realtime > 0;
+
+    unique_ptr<GameFrame> frame;
+    unique_ptr<FramePacer> pacer;
+    int width = 0;
+    int height = 0;
+    Window root = None;
+    Window target = None;       // captured window, None for the whole screen
+    if (display != nullptr)
     {
-        FILE *file = fopen(path.c_str(), "wb");
-        if (file == nullptr)
+        root = XRootWindow(display, XDefaultScreen(display));
+    }
+
+    if (!options.pipewire.empty())
+    {
+#ifdef LOOPGRAB_PIPEWIRE
+        // paced by the stream
+        const uint32_t node = options.pipewire == "any" ? PW_ID_ANY : (uint32_t)strtoul(options.pipewire.c_str(), nullptr, 10);
+        PipeWireFrame *stream = new PipeWireFrame(node);
+        frame.reset(stream);
+        if (!stream->ok())
         {
-            cerr << "error: failed to save PNG to " << path << ": " << strerror(errno) << endl;
-            return;
+            return 1;
         }
-
-        png_image png;
-        memset(&png, 0, sizeof(png));
-        png.version = PNG_IMAGE_VERSION;
-        png.width = image->width;
-        png.height = image->height;
-        png.format = PNG_FORMAT_BGRA;
-        uint32_t *pixels = new uint32_t[image->width * image->height];
-
-        for (int i = 0, y = 0; y < image->height; ++y)
+        width = stream->bounds().width();
+        height = stream->bounds().height();
+#endif
+    }
+    else if (!options.window.empty())
+    {
+        target = findWindow(display, root, options.window);
+        if (target == None)
         {
-            for (int x = 0; x < image->width; ++x, ++i)
-            {
-                pixels[i] = image->f.get_pixel(image, x, y) | 0xff000000;;
-            }
+            cerr << "error: no window found for " << options.window << endl;
+            return 1;
+        }
+        if (!WindowFrame::available(display))
+        {
+            cerr << "error: XComposite 0.2 not available for window capture" << endl;
+            return 1;
         }
 
-        unsigned bpp = 4;
-        unsigned scanline = png.width * bpp;
-        bool success = !!png_image_write_to_stdio(&png, file, 0, pixels, scanline, NULL);
-        delete[] pixels;
-        fclose(file);
+        WindowFrame *windowFrame = new WindowFrame(display, target);
+        frame.reset(windowFrame);
+        width = windowFrame->bounds().width();
+        height = windowFrame->bounds().height();
+        pacer = createPacer(display, target, options.pacing);
+        cerr << "window: 0x" << hex << target << dec << endl;
+    }
+    else
+    {
+        XWindowAttributes root_attr;
+        XGetWindowAttributes(display, root, &root_attr);
+        width = root_attr.width;
+        height = root_attr.height;
 
-        if (!success)
+        if (options.pipeline)
+        {
+            // paced by the capture thread
+            PipelinedFrame *pipelined = new PipelinedFrame(display, options.pacing);
+            frame.reset(pipelined);
+            realtime.apply(pipelined->captureThread().native_handle(), 1, "capture thread");
+        }
+        else
         {
-            cerr << "error: png_image_write_to_stdio(): failed to write PNG to " << path << endl;
+            frame.reset(new XImageFrame(display, root));
+            pacer = createPacer(display, root, options.pacing);
         }
     }
-};
-
-class XGameControls : public GameControls
-{
-    Display *display;
-    Window root;
 
-public:
+    cerr << "screen: width=" << width << ", height=" << height << ", pixel kernel: " << findPixelName << endl;
 
-    XGameControls(Display *display, Window root) :
-        display(display),
-        root(root)
+    unique_ptr<GameControls> xcontrols;
+    if (display != nullptr)
     {
+        xcontrols.reset(new XGameControls(display, root, options.input == "xtest-sync"));
     }
-
-    void fire()
+    else
     {
-        auto keycode = XKeysymToKeycode(display, XK_space);
-        XTestFakeKeyEvent(display, keycode, True, 0);
-        //usleep(500);
-        XTestFakeKeyEvent(display, keycode, False, 0);
-        XFlush(display);
+        cerr << "warning: no X display, pointer actions are ignored" << endl;
+        xcontrols.reset(new NullControls());
     }
 
-    void focus(int x, int y)
+    unique_ptr<GameControls> windowControls;
+    if (target != None)
     {
-        XWarpPointer(display, None, root, 0, 0, 0, 0, x, y);
-
-        Window window;
-        Window child;
-        int dummy;
-        unsigned udummy;
-        XQueryPointer(display, root, &window, &child, &dummy, &dummy, &dummy, &dummy, &udummy);
+        windowControls.reset(new WindowGameControls(*xcontrols, display, target, root));
+    }
+    GameControls& pointer = windowControls ? *windowControls : *xcontrols;
 
-        if (window)
+    unique_ptr<UInputGameControls> uinput;
+    if (options.input == "uinput" || display == nullptr)
+    {
+        uinput.reset(new UInputGameControls(pointer));
+        if (!uinput->ok())
         {
-            XSetInputFocus(display, child, RevertToNone, CurrentTime);
+            cerr << "warning: falling back to XTest input" << endl;
+            uinput.reset();
         }
     }
+    GameControls& input = uinput ? static_cast<GameControls&>(*uinput) : pointer;
+    cerr << "input: " << (uinput ? "uinput" : options.input) << endl;
 
-    void move(int x, int y)
+    unique_ptr<FrameRecorder> recorder;
+    if (!options.record.empty())
     {
-        XWarpPointer(display, None, root, 0, 0, 0, 0, x, y);
+        recorder.reset(new FrameRecorder(options.record, Rect(0, 0, width, height)));
+        frame.reset(new RecordingFrame(move(frame), *recorder));
     }
 
-    void click(int x, int y)
+    ofstream fireLog;
+    unique_ptr<RecordingControls> recordingControls;
+    if (!options.fireLog.empty())
     {
-        clickButton(x, y, Button1);
+        fireLog.open(options.fireLog);
+        recordingControls.reset(new RecordingControls(&input, *frame, fireLog));
     }
+    GameControls& controls = recordingControls ? static_cast<GameControls&>(*recordingControls) : input;
 
-    void clickButton(int x, int y, int button)
+    unique_ptr<SnapshotWriter> snapshots;
+    if (!options.snapshots.empty())
     {
-        XWarpPointer(display, None, root, 0, 0, 0, 0, x, y);
-
-        XEvent event;
-        memset(&event, 0, sizeof(event));
+        snapshots.reset(new SnapshotWriter((size_t)width * height, options.pngLevel));
+    }
 
-        event.type = ButtonPress;
-        event.xbutton.button = button;
-        event.xbutton.same_screen = True;
+    Calibration calibration;
+    if (options.calibrate)
+    {
+        if (calibration.load())
+        {
+            cerr << "calibration: " << Calibration::host() << ": latency=" << chrono::duration<double, milli>(calibration.latency).count()
+                << " ms, lead=" << chrono::duration<double, milli>(calibration.lead).count() << " ms from " << calibration.samples << " hits" << endl;
+        }
+        else
+        {
+            cerr << "calibration: nothing learned for " << Calibration::host() << " yet, starting from --lead and --deadzone" << endl;
+        }
+    }
 
-        XQueryPointer(display, root, &event.xbutton.root, &event.xbutton.window, &event.xbutton.x_root, &event.xbutton.y_root, &event.xbutton.x, &event.xbutton.y, &event.xbutton.state);
+    // only now: threads inherit policy and affinity, and the snapshot writer or the PipeWire loop at
+    // the game's priority on its CPU would block it for whole PNG encodes
+    realtime.apply(pthread_self(), 0, "game thread");
+    WorkerPool workers(options.threads);
+    for (int i = 1; i < workers.size(); ++i)
+    {
+        realtime.apply(workers.worker(i).native_handle(), options.pipeline ? i + 1 : i, "worker " + to_string(i));
+    }
 
-        event.xbutton.subwindow = event.xbutton.window;
-        while(event.xbutton.subwindow)
+    if (options.games > 1)
+    {
+        GameSupervisor supervisor(*frame, controls, width, height, options.games, [&](Game& game, int index)
         {
-            event.xbutton.window = event.xbutton.subwindow;
-
-            XQueryPointer(display, event.xbutton.window, &event.xbutton.root, &event.xbutton.subwindow, &event.xbutton.x_root, &event.xbutton.y_root, &event.xbutton.x, &event.xbutton.y, &event.xbutton.state);
+            setupGame(game, index, options, workers, snapshots.get(), calibration);
+        });
+        realtime.lockMemory();
+        while (supervisor.step())
+        {
+            supervisor.dumpPeriodically(cerr, options.statsInterval);
+            if (pacer)
+            {
+                pacer->wait(supervisor.region());
+            }
         }
-
-        if (XSendEvent(display, PointerWindow, True, 0xfff, &event) == 0)
+        supervisor.dump(cerr);
+        vector<const Game*> games;
+        for (size_t i = 0; i < supervisor.size(); ++i)
         {
-            cerr << "error: failed to simulate click (mousedown)" << endl;
+            games.push_back(&supervisor.game(i));
         }
-        XFlush(display);
-
-        //usleep(100);
-        event.type = ButtonRelease;
-        event.xbutton.state = 0x100;
-        if (XSendEvent(display, PointerWindow, True, 0xfff, &event) == 0)
+        saveCalibration(games);
+    }
+    else
+    {
+        Game game(controls, width, height, 1);
+        setupGame(game, 0, options, workers, snapshots.get(), calibration);
+        realtime.lockMemory();
+        while (game.step(*frame))
         {
-            cerr << "error: failed to simulate click (mouseup)" << endl;
+            game.instrumentation().dumpPeriodically(cerr, options.statsInterval);
+            if (pacer)
+            {
+                pacer->wait(game.region());
+            }
         }
-
-        XFlush(display);
+        game.instrumentation().dump(cerr);
+        saveCalibration({&game});
     }
-};
+    if (snapshots)
+    {
+        snapshots->dump(cerr);
+    }
+    return 0;
+}
 
 
 int main(int argc, char *argv[])
 {
-    (void) argc;
-    (void) argv;
-
-    auto display = XOpenDisplay((char *) NULL);
-    if (display != nullptr)
+    Options options;
+    if (!options.parse(argc, argv))
     {
-        auto screen = XDefaultScreen(display);
-        auto root = XRootWindow(display, screen);
+        return 1;
+    }
 
-        XWindowAttributes root_attr;
-        XGetWindowAttributes(display, root, &root_attr);
-        auto width = root_attr.width;
-        auto height = root_attr.height;
+    if (options.bench)
+    {
+        return GameBench(cout).run(options.replay);
+    }
 
-        cerr << "screen: width=" << width << ", height=" << height << endl;
+    if (options.simulate > 0)
+    {
+        return simulate(options);
+    }
 
-        XGameControls controls(display, root);
-        XImageFrame frame(display, root);
+    if (!options.replay.empty())
+    {
+        return replay(options);
+    }
 
-        Game game(controls, width, height, 1);
-        while (game.step(frame))
-        {
-            this_thread::sleep_for(chrono::milliseconds(1));
-        }
+    if (options.pipeline)
+    {
+        // capture thread uses its own connection, but Xlib still needs to know
+        XInitThreads();
     }
-    else
+
+    // only optional for PipeWire capture (controls then use uinput)
+    auto display = XOpenDisplay((char *) NULL);
+    if (display == nullptr && options.pipewire.empty())
     {
         cerr << "error: failed to open display" << endl;
+        return 1;
     }
 
-    XCloseDisplay(display);
-    return 0;
-}
+    const int status = play(display, options);
 
+    if (display != nullptr)
+    {
+        XCloseDisplay(display);
+    }
+    return status;
+}